@@ -1,60 +1,213 @@
 #include "ast.h"
+#include "debuginfo.h"
+#include "hostfn.h"
+#include "profile.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Transforms/IPO/HotColdSplitting.h"
 
 
-std::unique_ptr<LLVMContext> TheContext;
-std::unique_ptr<IRBuilder<>> Builder;
-std::unique_ptr<Module> TheModule;
-std::map<std::string, AllocaInst*> NamedValues;
+// Source locations live in ProgNode::Locations, not in the nodes.
+static_assert(sizeof(Node) <= 2 * sizeof(void*), "Node grew");
+
+thread_local std::unique_ptr<LLVMContext> TheContext;
+thread_local std::unique_ptr<IRBuilder<>> Builder;
+thread_local std::unique_ptr<Module> TheModule;
+thread_local std::map<std::string, AllocaInst*> NamedValues;
+thread_local bool BoundsChecks = true;
+thread_local bool BufferLog = false;
+thread_local std::string* CodegenErrors = nullptr;
+unsigned Verbosity = 0;
+
+static thread_local std::string LogText;
+static thread_local raw_string_ostream LogOS(LogText);
+
+/// TailRecurse - Loop header and parameter slots of the function being
+/// emitted.  Self tail calls store their arguments here and branch back to
+/// Header instead of growing the stack.
+static thread_local struct {
+  BasicBlock* Header = nullptr;
+  std::vector<AllocaInst*> Args;
+} TailRecurse;
 
 
 /// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
 /// the function.  This is used for mutable variables etc.
-AllocaInst* CreateEntryBlockAlloca(Function *TheFunction, const std::string &VarName) {
+AllocaInst* CreateEntryBlockAlloca(Function *TheFunction, const std::string &VarName, Type* Ty) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(),TheFunction->getEntryBlock().begin());
   
-  return TmpB.CreateAlloca(Type::getInt32Ty(*TheContext), nullptr,VarName);
+  return TmpB.CreateAlloca(Ty, nullptr,VarName);
+}
+
+Type* GetLLVMType(ValType t) {
+  // An array variable holds { element*, i64 length }.
+  if (IsArray(t))
+    return StructType::get(GetLLVMType(ElementType(t))->getPointerTo(),
+                           Type::getInt64Ty(*TheContext));
+  switch (t) {
+  case ValType::I64: return Type::getInt64Ty(*TheContext);
+  case ValType::F64: return Type::getDoubleTy(*TheContext);
+  default: return Type::getInt32Ty(*TheContext);
+  }
 }
 
+/// GetHostFunctionType - The declaration's type, arrays as two parameters.
+static FunctionType* GetHostFunctionType(const HostFunction& host) {
+  std::vector<Type*> Params;
+  for (ValType T : host.Sig.Params) {
+    if (IsArray(T)) {
+      Params.push_back(GetLLVMType(ElementType(T))->getPointerTo());
+      Params.push_back(Type::getInt64Ty(*TheContext));
+    } else {
+      Params.push_back(GetLLVMType(T));
+    }
+  }
+  return FunctionType::get(GetLLVMType(host.Sig.Ret), Params, false);
+}
 
+Value* CreateConversion(Value* V, Type* To) {
+  Type* From = V->getType();
+  if (From == To)
+    return V;
+  if (From->isDoubleTy())
+    return Builder->CreateFPToSI(V, To, "conv");
+  if (To->isDoubleTy())
+    return Builder->CreateSIToFP(V, To, "conv");
+  return Builder->CreateSExtOrTrunc(V, To, "conv");
+}
+
+Value* CreateIsTrue(Value* V, const Twine& Name) {
+  if (V->getType()->isDoubleTy())
+    return Builder->CreateFCmpONE(V, ConstantFP::get(V->getType(), 0.0), Name);
+  return Builder->CreateICmpNE(V, Constant::getNullValue(V->getType()), Name);
+}
 
 
-void InitializeModule() {
-  // Open a new context and module.
-  TheContext = std::make_unique<LLVMContext>();
+
+
+void InitializeModule(bool ReuseContext) {
+  // Open a new context and module.  A long-lived process may keep the
+  // thread's context, which already holds the types and constants it needs.
+  TheModule.reset();
+  if (!ReuseContext || !TheContext)
+    TheContext = std::make_unique<LLVMContext>();
   TheModule = std::make_unique<Module>("my cool jit", *TheContext);
 
   // Create a new builder for the module.
   Builder = std::make_unique<IRBuilder<>>(*TheContext);
 }
 
+/// OptimizeModule - Run the standard per-module pipeline over M.  Level 0
+/// leaves the IR untouched.  With TM the cost models know the target, which
+/// the vectorizers need to do anything.  SplitCold moves code a profile
+/// says never ran out of the hot functions.
+void OptimizeModule(Module& M, unsigned OptLevel, TargetMachine* TM, bool SplitCold) {
+  if (OptLevel == 0)
+    return;
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassBuilder PB(TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  OptimizationLevel Level = OptLevel == 1 ? OptimizationLevel::O1
+                          : OptLevel == 2 ? OptimizationLevel::O2
+                                          : OptimizationLevel::O3;
+  ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(Level);
+  if (SplitCold)
+    MPM.addPass(HotColdSplittingPass());
+  MPM.run(M, MAM);
+}
+
+raw_ostream& Log(unsigned level) {
+  if (Verbosity < level)
+    return nulls();
+  if (BufferLog)
+    return LogOS;
+  return outs();
+}
+
+std::string TakeLog() {
+  std::string Text;
+  std::swap(Text, LogOS.str());
+  return Text;
+}
+
+void Node::printinfo(int depth) const {
+  print(outs(), depth);
+}
+
+/// PrintJsonChild - Write child, or null for a missing one.
+static void PrintJsonChild(json::OStream& J, const Node* child) {
+  if (child)
+    child->printjson(J);
+  else
+    J.value(nullptr);
+}
+
 ProgNode::ProgNode(std::vector<std::unique_ptr<Node>> defs) : defs{std::move(defs)} {}
 
-void ProgNode::printinfo(int depth) const {
-  std::cout << std::string(depth, ' ') << "ProgNode:\n";
+void ProgNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "ProgNode:\n";
   for (const auto& def : defs) {
-    def->printinfo(depth + 2);
+    def->print(OS, depth + 2);
   }
 }
 
+void ProgNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "Prog");
+    J.attributeArray("defs", [&] {
+      for (const auto& def : defs)
+        PrintJsonChild(J, def.get());
+    });
+  });
+}
+
 Value* ProgNode::codegen() {
+  TypeEnv Env;
+  if (inferType(Env) == ValType::Unknown)
+    return nullptr;
+
+  // Declare every function first so calls may refer to later definitions.
+  for (auto &def : defs)
+    static_cast<FunDefNode*>(def.get())->codegenProto();
+
   for (auto &def : defs) {
     if (!def->codegen()) {
       return nullptr;
     }
   }
+  FinishModuleProfile();
   return Constant::getNullValue(Type::getInt32Ty(*TheContext)); // 或其他适当的返回值
 }
 
 
 StmtListNode::StmtListNode(std::vector<std::unique_ptr<Node>> stmts) : stmts{std::move(stmts)} {}
 
-void StmtListNode::printinfo(int depth) const {
-  std::cout << std::string(depth, ' ') << "StmtListNode:\n";
+void StmtListNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "StmtListNode:\n";
   for (const auto& stmt : stmts) {
-    stmt->printinfo(depth + 2);
+    stmt->print(OS, depth + 2);
   }
 }
 
+void StmtListNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "StmtList");
+    J.attributeArray("stmts", [&] {
+      for (const auto& stmt : stmts)
+        PrintJsonChild(J, stmt.get());
+    });
+  });
+}
+
 Value* StmtListNode::codegen() {
   Value* lastValue = nullptr;
   for (auto& stmt : stmts) {
@@ -65,11 +218,22 @@ Value* StmtListNode::codegen() {
   }
   return lastValue; // 返回最后一个语句的值
 }
+
+void StmtListNode::markTailPosition(bool tail) {
+  // Only the last statement produces the list's value.
+  if (!stmts.empty())
+    stmts.back()->markTailPosition(tail);
+}
+
+void StmtListNode::collectCallees(std::set<std::string>& callees) const {
+  for (const auto& stmt : stmts)
+    stmt->collectCallees(callees);
+}
   
 VarNode::VarNode(const std::string& name) : VarName(name) {}
 
-void VarNode::printinfo(int depth) const {
-  std::cout << std::string(depth, ' ') << "VarNode: " << VarName << '\n';
+void VarNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "VarNode: " << VarName << '\n';
 }  
 
 Value* VarNode::codegen() {
@@ -79,47 +243,201 @@ Value* VarNode::codegen() {
     return Ast2IRError("Unknown variable name");
 
   // Load the value.
+  EmitLocation(this);
   return Builder->CreateLoad(A->getAllocatedType(), A, VarName.c_str());
 }
 
+void VarNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "Var");
+    J.attribute("name", VarName);
+  });
+}
+
+
+
+IndexExpNode::IndexExpNode(const std::string& name,std::unique_ptr<Node> index)
+  : ArrayName(name), Index{std::move(index)} {}
+
+void IndexExpNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "IndexExpNode: " << ArrayName << '\n';
+  Index->print(OS, depth + 2);
+}
+
+void IndexExpNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "IndexExp");
+    J.attribute("array", ArrayName);
+    J.attributeBegin("index");
+    PrintJsonChild(J, Index.get());
+    J.attributeEnd();
+  });
+}
+
+Value* IndexExpNode::codegenAddress() {
+  AllocaInst *A = NamedValues[ArrayName];
+  if (!A)
+    return Ast2IRError("Unknown variable name");
+  Value* IndexV = Index->codegen();
+  if (!IndexV)
+    return nullptr;
+  EmitLocation(this);
+  IndexV = CreateConversion(IndexV, Type::getInt64Ty(*TheContext));
+
+  auto* ArrayTy = cast<StructType>(A->getAllocatedType());
+  Type* EltTy = GetLLVMType(Ty);
+  Value* Ptr = Builder->CreateLoad(ArrayTy->getElementType(0),
+    Builder->CreateStructGEP(ArrayTy, A, 0), ArrayName + ".ptr");
+
+  if (BoundsChecks) {
+    // One unsigned compare also catches negative indexes.
+    Value* Len = Builder->CreateLoad(ArrayTy->getElementType(1),
+      Builder->CreateStructGEP(ArrayTy, A, 1), ArrayName + ".len");
+    Value* InRange = Builder->CreateICmpULT(IndexV, Len, "inbounds");
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock* OkBB = BasicBlock::Create(*TheContext, "bounds.ok", TheFunction);
+    BasicBlock* TrapBB = BasicBlock::Create(*TheContext, "bounds.fail", TheFunction);
+    Builder->CreateCondBr(InRange, OkBB, TrapBB,
+                          MDBuilder(*TheContext).createBranchWeights(1 << 20, 1));
+    Builder->SetInsertPoint(TrapBB);
+    Builder->CreateCall(Intrinsic::getDeclaration(TheModule.get(), Intrinsic::trap));
+    Builder->CreateUnreachable();
+    Builder->SetInsertPoint(OkBB);
+  }
+  return Builder->CreateInBoundsGEP(EltTy, Ptr, IndexV, ArrayName + ".elt");
+}
+
+Value* IndexExpNode::codegen() {
+  Value* Addr = codegenAddress();
+  if (!Addr)
+    return nullptr;
+  return Builder->CreateLoad(GetLLVMType(Ty), Addr, ArrayName + ".val");
+}
+
+Value* IndexExpNode::codegenStore(Value* V) {
+  Value* Addr = codegenAddress();
+  if (!Addr)
+    return nullptr;
+  Builder->CreateStore(V, Addr);
+  return V;
+}
+
+void IndexExpNode::collectCallees(std::set<std::string>& callees) const {
+  Index->collectCallees(callees);
+}
   
-NumNode::NumNode(int num) : NumVal(num) {}
+NumNode::NumNode(int64_t num) : NumVal(num) {
+  Ty = num == int32_t(num) ? ValType::I32 : ValType::I64;
+}
+
+NumNode::NumNode(double num) : FPVal(num) {
+  Ty = ValType::F64;
+}
 
-void NumNode::printinfo(int depth) const{
-  std::cout << std::string(depth, ' ') << "NumNode: " << NumVal << '\n';
+void NumNode::print(raw_ostream& OS, int depth) const{
+  OS.indent(depth) << "NumNode: ";
+  if (Ty == ValType::F64)
+    OS << format("%g", FPVal) << '\n';
+  else
+    OS << NumVal << '\n';
+}
+
+void NumNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "Num");
+    J.attribute("type", TypeName(Ty));
+    if (Ty == ValType::F64)
+      J.attribute("value", FPVal);
+    else
+      J.attribute("value", NumVal);
+  });
 }
 
 Value* NumNode::codegen() {
-  return ConstantInt::get(Type::getInt32Ty(*TheContext), NumVal);
+  if (Ty == ValType::F64)
+    return ConstantFP::get(*TheContext, APFloat(FPVal));
+  return ConstantInt::get(GetLLVMType(Ty), NumVal, true);
 }
   
 BinExpNode::BinExpNode(char op,std::unique_ptr<Node> lhs,std::unique_ptr<Node> rhs)
 	: Op(op), LHS{std::move(lhs)}, RHS{std::move(rhs)} {}
+
+BinExpNode::~BinExpNode() {
+  // Unlink the chain a node at a time, so none frees the next recursively.
+  while (auto* L = dynamic_cast<BinExpNode*>(LHS.get()))
+    LHS = std::move(L->LHS);
+}
+
+template <typename T> static std::vector<T*> Chain(T* top) {
+  std::vector<T*> chain{top};
+  while (auto* L = dynamic_cast<T*>(chain.back()->LHS.get())) {
+    if (L->Op == '=')
+      break;
+    chain.push_back(L);
+  }
+  return chain;
+}
+
+std::vector<BinExpNode*> BinExpNode::chain() { return Chain(this); }
+
+std::vector<const BinExpNode*> BinExpNode::chain() const { return Chain(this); }
   	
-void BinExpNode::printinfo(int depth) const {
-  std::cout << std::string(depth, ' ') << "BinExpNode:\n";
-    
-  if (LHS)
-    LHS->printinfo(depth + 2);
-  else 
-    std::cout << std::string(depth + 2, ' ') << "Nullptr" << '\n';
-    
-  std::cout << std::string(depth + 2, ' ') << "Op: "<< Op << '\n';
-    
-  if (RHS) 
-    RHS->printinfo(depth + 2);
+void BinExpNode::print(raw_ostream& OS, int depth) const {
+  // As if each printed its LHS, Op and RHS two deeper: the headers going
+  // down the chain, the innermost LHS, then Op and RHS coming back up.
+  auto Nodes = chain();
+  for (size_t i = 0; i != Nodes.size(); ++i)
+    OS.indent(depth + 2 * i) << "BinExpNode:\n";
+
+  int inner = depth + 2 * Nodes.size();
+  if (const Node* L = Nodes.back()->LHS.get())
+    L->print(OS, inner);
   else 
-    std::cout << std::string(depth + 2, ' ') << "Nullptr" << '\n';
+    OS.indent(inner) << "Nullptr" << '\n';
+
+  for (size_t i = Nodes.size(); i--;) {
+    int d = depth + 2 * i + 2;
+    OS.indent(d) << "Op: "<< Nodes[i]->Op << '\n';
+    if (Nodes[i]->RHS) 
+      Nodes[i]->RHS->print(OS, d);
+    else 
+      OS.indent(d) << "Nullptr" << '\n';
+  }
+}
+
+void BinExpNode::printjson(json::OStream& J) const {
+  // Objects opened down the chain and closed coming back up; see print.
+  auto Nodes = chain();
+  for (const BinExpNode* N : Nodes) {
+    J.objectBegin();
+    J.attribute("kind", "BinExp");
+    J.attribute("op", std::string(1, N->Op));
+    J.attributeBegin("lhs");
+  }
+  PrintJsonChild(J, Nodes.back()->LHS.get());
+  for (size_t i = Nodes.size(); i--;) {
+    J.attributeEnd();
+    J.attributeBegin("rhs");
+    PrintJsonChild(J, Nodes[i]->RHS.get());
+    J.attributeEnd();
+    J.objectEnd();
+  }
 }
 
 
 Value* BinExpNode::codegen() {
   // Special case '=' because we don't want to emit the LHS as an expression.
   if (Op == '=') {
-    // This assume we're building without RTTI because LLVM builds that way by
-    // default. If you build LLVM with RTTI this can be changed to a
-    // dynamic_cast for automatic error checking.
-    VarNode* LHSE = static_cast<VarNode*>(LHS.get());
+    if (auto* Elt = dynamic_cast<IndexExpNode*>(LHS.get())) {
+      Value* Val = RHS->codegen();
+      if (!Val)
+        return nullptr;
+      return Elt->codegenStore(CreateConversion(Val, GetLLVMType(Ty)));
+    }
+
+    // The parser only puts a variable or an array element here; a tree
+    // from elsewhere may not.
+    VarNode* LHSE = dynamic_cast<VarNode*>(LHS.get());
     if (!LHSE)
       return Ast2IRError("destination of '=' must be a variable");
       // Codegen the RHS.
@@ -128,172 +446,425 @@ Value* BinExpNode::codegen() {
       return nullptr;
 
     // Look up the name.
-    Value* Variable = NamedValues[LHSE->VarName];
+    AllocaInst* Variable = NamedValues[LHSE->VarName];
     if (!Variable)
       return Ast2IRError("Unknown variable name");
 
+    EmitLocation(this);
+    Val = CreateConversion(Val, Variable->getAllocatedType());
     Builder->CreateStore(Val, Variable);
     return Val;
   }
-  Value* L= LHS->codegen();
+
+  // The innermost LHS first, then each operator outwards; see chain.
+  auto Nodes = chain();
+  Value* L = Nodes.back()->LHS->codegen();
+  for (size_t i = Nodes.size(); i--;)
+    L = Nodes[i]->codegenOp(L);
+  return L;
+}
+
+Value* BinExpNode::codegenOp(Value* L) {
   Value* R = RHS->codegen();
   if (!L || !R)
     return nullptr;
+  EmitLocation(this);
+
+  // Both operands are brought to the wider type first.
+  Type* OpTy = GetLLVMType(Widen(LHS->Ty, RHS->Ty));
+  L = CreateConversion(L, OpTy);
+  R = CreateConversion(R, OpTy);
+  bool FP = OpTy->isDoubleTy();
 
   switch (Op) {
   case '+':
-    return Builder->CreateAdd(L, R, "addtmp");
+    return FP ? Builder->CreateFAdd(L, R, "addtmp") : Builder->CreateAdd(L, R, "addtmp");
   case '-':
-    return Builder->CreateSub(L, R, "subtmp");
+    return FP ? Builder->CreateFSub(L, R, "subtmp") : Builder->CreateSub(L, R, "subtmp");
   case '*':
-    return Builder->CreateMul(L, R, "multmp");
+    return FP ? Builder->CreateFMul(L, R, "multmp") : Builder->CreateMul(L, R, "multmp");
   case '/':
-    return Builder->CreateSDiv(L, R, "divtmp");
+    return FP ? Builder->CreateFDiv(L, R, "divtmp") : Builder->CreateSDiv(L, R, "divtmp");
+  case '<':
+    L = FP ? Builder->CreateFCmpOLT(L, R, "cmptmp") : Builder->CreateICmpSLT(L, R, "cmptmp");
+    // Convert bool 0/1 to the language's int.
+    return Builder->CreateZExt(L, Type::getInt32Ty(*TheContext), "booltmp");
+  case '>':
+    L = FP ? Builder->CreateFCmpOGT(L, R, "cmptmp") : Builder->CreateICmpSGT(L, R, "cmptmp");
+    return Builder->CreateZExt(L, Type::getInt32Ty(*TheContext), "booltmp");
   default:
     return Ast2IRError("invalid binary operator");
   }
 }
 
+void BinExpNode::collectCallees(std::set<std::string>& callees) const {
+  auto Nodes = chain();
+  Nodes.back()->LHS->collectCallees(callees);
+  for (const BinExpNode* N : Nodes)
+    N->RHS->collectCallees(callees);
+}
+
 
 CalleeExpNode::CalleeExpNode(const std::string& name,std::vector<std::unique_ptr<Node>> args)
   	: Callee(name), CalleeArgs{std::move(args)} {}
   	
-void CalleeExpNode::printinfo(int depth) const{
-    std::cout << std::string(depth, ' ') << "CalleeExpNode: " << Callee << '\n';
-    std::cout << std::string(depth+2, ' ') << "CalleeArgs: " << '\n';
+void CalleeExpNode::print(raw_ostream& OS, int depth) const{
+    OS.indent(depth) << "CalleeExpNode: " << Callee << '\n';
+    OS.indent(depth+2) << "CalleeArgs: " << '\n';
     for (const auto& arg : CalleeArgs) {
-        arg->printinfo(depth + 4);
+        arg->print(OS, depth + 4);
     }
 }
 
+void CalleeExpNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "CalleeExp");
+    J.attribute("callee", Callee);
+    J.attributeArray("args", [&] {
+      for (const auto& arg : CalleeArgs)
+        PrintJsonChild(J, arg.get());
+    });
+  });
+}
+
 
 Value* CalleeExpNode::codegen() {
-  // Look up the name in the global module table.
+  // i32(x), i64(x) and f64(x) are conversions, not calls.
+  ValType ConvTy;
+  if (ParseTypeName(Callee, ConvTy)) {
+    if (CalleeArgs.size() != 1)
+      return Ast2IRError("conversion takes one argument");
+    Value* V = CalleeArgs[0]->codegen();
+    if (!V)
+      return nullptr;
+    EmitLocation(this);
+    return CreateConversion(V, GetLLVMType(ConvTy));
+  }
+
+  if (Callee == "len") {
+    Value* A = CalleeArgs.size() == 1 ? CalleeArgs[0]->codegen() : nullptr;
+    if (!A)
+      return nullptr;
+    EmitLocation(this);
+    return Builder->CreateExtractValue(A, 1, "len");
+  }
+
+  // Look up the name in the global module table, then among the host
+  // functions, which are declared on first use.
   Function* CalleeF = TheModule->getFunction(Callee);
-  if (!CalleeF)
+  const HostFunction* Host = CalleeF ? nullptr : FindHostFunction(Callee);
+  if (!CalleeF && !Host)
     return Ast2IRError("Unknown function referenced");
+  FunctionType* FT = CalleeF ? CalleeF->getFunctionType() : GetHostFunctionType(*Host);
 
-  // If argument mismatch error.
-  if (CalleeF->arg_size() != CalleeArgs.size())
+  // If argument mismatch error.  Arrays take two parameters.
+  unsigned NumParams = 0;
+  for (const auto& arg : CalleeArgs)
+    NumParams += IsArray(arg->Ty) ? 2 : 1;
+  if (FT->getNumParams() != NumParams)
     return Ast2IRError("Incorrect # arguments passed");
 
+  // ArgsV holds one value per source argument, an array as its { ptr, len }.
   std::vector<Value*> ArgsV;
+  unsigned Param = 0;
   for (unsigned i = 0, e = CalleeArgs.size(); i != e; ++i) {
-    ArgsV.push_back(CalleeArgs[i]->codegen());
-    if (!ArgsV.back())
+    Value* Arg = CalleeArgs[i]->codegen();
+    if (!Arg)
       return nullptr;
+    if (!IsArray(CalleeArgs[i]->Ty))
+      Arg = CreateConversion(Arg, FT->getParamType(Param));
+    ArgsV.push_back(Arg);
+    Param += IsArray(CalleeArgs[i]->Ty) ? 2 : 1;
+  }
+  EmitLocation(this);
+
+  std::vector<Value*> Params;
+  auto ExpandArgs = [&] {
+    for (Value* Arg : ArgsV) {
+      if (Arg->getType()->isStructTy()) {
+        Params.push_back(Builder->CreateExtractValue(Arg, 0));
+        Params.push_back(Builder->CreateExtractValue(Arg, 1));
+      } else {
+        Params.push_back(Arg);
+      }
+    }
+  };
+
+  if (Host && Host->Inline) {
+    ExpandArgs();
+    Value* V = Host->Inline(*Builder, Params);
+    return V ? CreateConversion(V, FT->getReturnType()) : nullptr;
+  }
+  if (Host) // The arguments may have declared it already.
+    CalleeF = cast<Function>(TheModule->getOrInsertFunction(Callee, FT).getCallee());
+
+  // Count before the call: nothing may sit between a musttail call and ret.
+  unsigned Site = NextProfileSite();
+  CountCall(Site);
+
+  Function* TheFunction = Builder->GetInsertBlock()->getParent();
+  if (IsTail && CalleeF == TheFunction && TailRecurse.Header) {
+    // Self tail call: rebind the parameters and jump back to the top.  All
+    // arguments are evaluated above, before any parameter is overwritten.
+    for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+      Builder->CreateStore(ArgsV[i], TailRecurse.Args[i]);
+    Builder->CreateBr(TailRecurse.Header);
+
+    // Whatever the caller emits after us is unreachable; give it a block.
+    BasicBlock* DeadBB = BasicBlock::Create(*TheContext, "aftertail", TheFunction);
+    Builder->SetInsertPoint(DeadBB);
+    return UndefValue::get(CalleeF->getReturnType());
   }
 
-  return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  ExpandArgs();
+  CallInst* Call = Builder->CreateCall(CalleeF, Params, "calltmp");
+  if (IsTail)
+    Call->setTailCall();
+  AnnotateCall(Call, Site);
+  return Call;
+}
+
+void CalleeExpNode::markTailPosition(bool tail) {
+  IsTail = tail;
+}
+
+void CalleeExpNode::collectCallees(std::set<std::string>& callees) const {
+  callees.insert(Callee);
+  for (const auto& arg : CalleeArgs)
+    arg->collectCallees(callees);
 }
 
 
-LetExpNode::LetExpNode(std::unique_ptr<Node> var,std::unique_ptr<Node> exp)
-	: LetVar{std::move(var)}, LetBody{std::move(exp)} {}
+LetExpNode::LetExpNode(std::unique_ptr<Node> var,std::unique_ptr<Node> exp,ValType varty)
+	: LetVar{std::move(var)}, LetBody{std::move(exp)}, VarTy(varty) {}
 	
-void LetExpNode::printinfo(int depth) const {
-    std::cout << std::string(depth, ' ') << "LetExpNode:\n" ;
+void LetExpNode::print(raw_ostream& OS, int depth) const {
+    OS.indent(depth) << "LetExpNode:\n" ;
     if (!LetVar) {
-        std::cout << std::string(depth + 2, ' ') << "Nullptr" << '\n';
+        OS.indent(depth + 2) << "Nullptr" << '\n';
         return;  
     }
-    std::cout << std::string(depth + 2, ' ') << "LetVar: \n";
+    OS.indent(depth + 2) << "LetVar: ";
+    if (VarTy != ValType::Unknown)
+        OS << TypeName(VarTy);
+    OS << '\n';
     
-    LetVar->printinfo(depth + 4);
+    LetVar->print(OS, depth + 4);
     
-    std::cout << std::string(depth + 2, ' ') << "LetBody: \n";
+    OS.indent(depth + 2) << "LetBody: \n";
     
     if (!LetBody) {
-        std::cout << std::string(depth + 2, ' ') << "Nullptr" << '\n';
+        OS.indent(depth + 2) << "Nullptr" << '\n';
         return;  
     }
 
-    LetBody->printinfo(depth + 4);
+    LetBody->print(OS, depth + 4);
+}
+
+void LetExpNode::printjson(json::OStream& J) const {
+    J.object([&] {
+      J.attribute("kind", "LetExp");
+      if (VarTy != ValType::Unknown)
+        J.attribute("type", TypeName(VarTy));
+      J.attributeBegin("var");
+      PrintJsonChild(J, LetVar.get());
+      J.attributeEnd();
+      J.attributeBegin("body");
+      PrintJsonChild(J, LetBody.get());
+      J.attributeEnd();
+    });
 }
 
 
 Value* LetExpNode::codegen() {
-    // 生成变量初始化的代码
-    Value* VarValue = LetVar->codegen();
-    if (!VarValue)
-      return nullptr;
-    
-    std::unique_ptr<VarNode> newVarNodePtr = std::unique_ptr<VarNode>(static_cast<VarNode*>(LetVar.release()));
-    
     // 假设 LetVar 是一个变量节点，并且它是整型（i32）
-    AllocaInst* Alloca = Builder->CreateAlloca(Type::getInt32Ty(*TheContext), nullptr, newVarNodePtr->VarName.c_str());
+    VarNode* LetVarNode = static_cast<VarNode*>(LetVar.get());
     
     Value* BodyValue = LetBody->codegen();
     if (!BodyValue)
       return nullptr;
     
+    // The slot lives in the entry block so that a let inside a tail-recursive
+    // body does not grow the stack on every iteration.
+    Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    AllocaInst* Alloca = CreateEntryBlockAlloca(TheFunction, LetVarNode->VarName,
+                                                GetLLVMType(Ty));
+    EmitLocation(this);
+    DeclareVariable(Alloca, LetVarNode->VarName, Ty, this);
+    
     // 存储初始化值到变量中
+    BodyValue = CreateConversion(BodyValue, Alloca->getAllocatedType());
     Builder->CreateStore(BodyValue, Alloca);
-    
+    NamedValues[LetVarNode->VarName] = Alloca;
+
+    return BodyValue;
+}
 
-    // 返回分配的地址作为变量值
-    return Alloca;
+void LetExpNode::collectCallees(std::set<std::string>& callees) const {
+    LetBody->collectCallees(callees);
 }
 
 
 
   
-FunDefNode::FunDefNode(const std::string& name,std::vector<std::string> args,std::unique_ptr<Node> body)
-	: FunDefName(name), FunDefArgs{std::move(args)}, FunDefBody{std::move(body)} {}
+FunDefNode::FunDefNode(const std::string& name,std::vector<std::string> args,std::unique_ptr<Node> body,
+                       std::vector<ValType> argtys, ValType retty)
+	: FunDefName(name), FunDefArgs{std::move(args)}, FunDefBody{std::move(body)},
+	  FunDefArgTypes{std::move(argtys)}, RetTy(retty) {}
+
+ValType FunDefNode::getArgType(unsigned i) const {
+    if (i < FunDefArgTypes.size() && FunDefArgTypes[i] != ValType::Unknown)
+        return FunDefArgTypes[i];
+    return ValType::I32;
+}
   	
-void FunDefNode::printinfo(int depth) const {
-    std::cout << std::string(depth, ' ') << "FunctionNode: " << FunDefName << '\n';
-    std::cout << std::string(depth + 2, ' ') << "Params: ";
+void FunDefNode::print(raw_ostream& OS, int depth) const {
+    OS.indent(depth) << "FunctionNode: " << FunDefName << '\n';
+    OS.indent(depth + 2) << "Params: ";
     if (FunDefArgs.size() == 0)
-        std::cout << "None";
+        OS << "None";
     else {
-        for (const auto& arg : FunDefArgs) {
-            std::cout << arg << " ";
+        for (unsigned i = 0; i != FunDefArgs.size(); ++i) {
+            OS << FunDefArgs[i];
+            if (i < FunDefArgTypes.size() && FunDefArgTypes[i] != ValType::Unknown)
+                OS << ':' << TypeName(FunDefArgTypes[i]);
+            OS << " ";
         }
     }
-    std::cout << '\n';
+    OS << '\n';
+    if (RetTy != ValType::Unknown)
+        OS.indent(depth + 2) << "Returns: " << TypeName(RetTy) << '\n';
 
     if (!FunDefBody) {
-        std::cout << std::string(depth + 2, ' ') << "Nullptr" << '\n';
+        OS.indent(depth + 2) << "Nullptr" << '\n';
         return;  
     }
 
-    FunDefBody->printinfo(depth + 2);
+    FunDefBody->print(OS, depth + 2);
 }
 
+void FunDefNode::printjson(json::OStream& J) const {
+    J.object([&] {
+      J.attribute("kind", "FunDef");
+      J.attribute("name", FunDefName);
+      J.attributeArray("params", [&] {
+        for (const auto& arg : FunDefArgs)
+          J.value(arg);
+      });
+      if (!FunDefArgTypes.empty())
+        J.attributeArray("paramTypes", [&] {
+          for (ValType t : FunDefArgTypes)
+            J.value(t == ValType::Unknown ? nullptr : json::Value(TypeName(t)));
+        });
+      if (RetTy != ValType::Unknown)
+        J.attribute("returns", TypeName(RetTy));
+      J.attributeBegin("body");
+      PrintJsonChild(J, FunDefBody.get());
+      J.attributeEnd();
+    });
+}
+
+void FunDefNode::collectCallees(std::set<std::string>& callees) const {
+    FunDefBody->collectCallees(callees);
+}
 
-Function* FunDefNode::codegen() {
-  // Make the function type:  int(int, int) etc.
-  std::vector<Type*> Ints(FunDefArgs.size(), Type::getInt32Ty(*TheContext));
-  FunctionType *FT = FunctionType::get(Type::getInt32Ty(*TheContext), Ints, false);
 
-  Function* F =
-    Function::Create(FT, Function::ExternalLinkage, FunDefName, TheModule.get());
-  // Set names for all arguments.
+Function* FunDefNode::codegenProto() {
+  if (Function* F = TheModule->getFunction(FunDefName))
+    return F;
+
+  // Make the function type from the declared and inferred types.
+  // An array parameter is passed as its pointer and length.
+  std::vector<Type*> Params;
+  for (unsigned i = 0; i != FunDefArgs.size(); ++i) {
+    Type* T = GetLLVMType(getArgType(i));
+    if (auto* ST = dyn_cast<StructType>(T)) {
+      Params.push_back(ST->getElementType(0));
+      Params.push_back(ST->getElementType(1));
+    } else {
+      Params.push_back(T);
+    }
+  }
+  FunctionType *FT = FunctionType::get(GetLLVMType(Ty), Params, false);
+
+  // Functions nobody outside the module can call are internal, which lets the
+  // optimizer inline, specialize or delete them freely.
+  Function* F = Function::Create(FT,
+    Exported ? Function::ExternalLinkage : Function::InternalLinkage,
+    FunDefName, TheModule.get());
+  // Set names for all arguments.  Nothing keeps an array past the call.
   unsigned Idx = 0;
-  for (auto &Arg : F->args())
-    Arg.setName(FunDefArgs[Idx++]);
+  for (unsigned i = 0; i != FunDefArgs.size(); ++i) {
+    F->getArg(Idx++)->setName(FunDefArgs[i]);
+    if (IsArray(getArgType(i))) {
+      F->addParamAttr(Idx - 1, Attribute::NoCapture);
+      F->getArg(Idx++)->setName(FunDefArgs[i] + ".len");
+    }
+  }
+  return F;
+}
+
+Function* FunDefNode::codegen() {
+  Function* F = codegenProto();
+  if (!F->empty()) {
+    Ast2IRError("Function cannot be redefined");
+    return nullptr;
+  }
 
   // Create a new basic block to start insertion into.
   BasicBlock* BB = BasicBlock::Create(*TheContext, "entry", F);
   Builder->SetInsertPoint(BB);
+  BeginFunctionDebugInfo(*this, F);
 
   // Record the function arguments in the NamedValues map.
   NamedValues.clear();
-  for (auto& Arg : F->args()){
+  TailRecurse.Args.clear();
+  auto ArgIt = F->arg_begin();
+  for (unsigned i = 0; i != FunDefArgs.size(); ++i){
     // Create an alloca for this variable.
-    AllocaInst *Alloca = CreateEntryBlockAlloca(F, Arg.getName().str());
-
-    // Store the initial value into the alloca.
-    Builder->CreateStore(&Arg, Alloca);
+    Type* T = GetLLVMType(getArgType(i));
+    AllocaInst *Alloca = CreateEntryBlockAlloca(F, FunDefArgs[i], T);
+
+    // Store the initial value into the alloca; an array is put back
+    // together from its pointer and length.
+    Value* V = &*ArgIt++;
+    if (T->isStructTy()) {
+      V = Builder->CreateInsertValue(UndefValue::get(T), V, 0);
+      V = Builder->CreateInsertValue(V, &*ArgIt++, 1);
+    }
+    Builder->CreateStore(V, Alloca);
+    DeclareVariable(Alloca, FunDefArgs[i], getArgType(i), this, i + 1);
 
     // Add arguments to variable symbol table.
-    NamedValues[std::string(Arg.getName())] = Alloca;
+    NamedValues[FunDefArgs[i]] = Alloca;
+    TailRecurse.Args.push_back(Alloca);
   }
+
+  BeginFunctionProfile(F);
+
+  // The body starts in its own block so self tail calls can loop back to it.
+  TailRecurse.Header = BasicBlock::Create(*TheContext, "tailrecurse", F);
+  Builder->CreateBr(TailRecurse.Header);
+  Builder->SetInsertPoint(TailRecurse.Header);
+  FunDefBody->markTailPosition(true);
     
   if (Value* RetVal = FunDefBody->codegen()) {
+    TailRecurse.Header = nullptr;
+    RetVal = CreateConversion(RetVal, F->getReturnType());
+    ExitFunctionProfile();
+
+    // A call to a function of the same type that is immediately returned can
+    // be guaranteed to reuse our frame.
+    CallInst* CI = dyn_cast<CallInst>(RetVal);
+    if (CI && CI->isTailCall() && CI == &Builder->GetInsertBlock()->back() &&
+        CI->getFunctionType() == F->getFunctionType())
+      CI->setTailCallKind(CallInst::TCK_MustTail);
+
     // Finish off the function.
     Builder->CreateRet(RetVal);
+    FinishFunctionProfile(F);
+
+    EndFunctionDebugInfo();
 
     // Validate the generated code, checking for consistency.
     verifyFunction(*F);
@@ -302,6 +873,8 @@ Function* FunDefNode::codegen() {
   }
   
   // Error reading body, remove function.
+  TailRecurse.Header = nullptr;
+  EndFunctionDebugInfo();
   F->eraseFromParent();
   return nullptr;
 }
@@ -310,37 +883,56 @@ Function* FunDefNode::codegen() {
 IfExpNode::IfExpNode(std::unique_ptr<Node> cond,std::unique_ptr<Node> then,std::unique_ptr<Node> els) 
 	: Cond{std::move(cond)},Then{std::move(then)},Else{std::move(els)} {}
   
-void IfExpNode::printinfo(int depth) const {
-  std::cout << std::string(depth, ' ') << "IfExpNode: " << '\n';
-  std::cout << std::string(depth+2, ' ') << "Condition: " << '\n';
-  Cond -> printinfo(depth+4);
+void IfExpNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "IfExpNode: " << '\n';
+  OS.indent(depth+2) << "Condition: " << '\n';
+  Cond -> print(OS, depth+4);
   
-  std::cout << std::string(depth+2, ' ') << "Then: " << '\n';
-  Then -> printinfo(depth+4);
+  OS.indent(depth+2) << "Then: " << '\n';
+  Then -> print(OS, depth+4);
+
+  OS.indent(depth+2) << "Else: " << '\n';
+  Else -> print(OS, depth+4);
+}
 
-  std::cout << std::string(depth+2, ' ') << "Else: " << '\n';
-  Else -> printinfo(depth+4);
+void IfExpNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "IfExp");
+    J.attributeBegin("cond");
+    PrintJsonChild(J, Cond.get());
+    J.attributeEnd();
+    J.attributeBegin("then");
+    PrintJsonChild(J, Then.get());
+    J.attributeEnd();
+    J.attributeBegin("else");
+    PrintJsonChild(J, Else.get());
+    J.attributeEnd();
+  });
 }
 
 Value* IfExpNode::codegen() {
   Value* CondV = Cond->codegen();
   if (!CondV)
     return Ast2IRError("condition codegen failed");
+  EmitLocation(this);
     
-  CondV = Builder->CreateICmpNE(CondV, ConstantInt::get(*TheContext, APInt(32, 0)), "ifcond");
+  CondV = CreateIsTrue(CondV, "ifcond");
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
   
   BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
   BasicBlock *ElseBB = BasicBlock::Create(*TheContext, "else");
   BasicBlock *MergeBB = BasicBlock::Create(*TheContext, "ifcont");
 
-  Builder->CreateCondBr(CondV, ThenBB, ElseBB);
+  unsigned Site = NextProfileSite();
+  AnnotateBranch(Builder->CreateCondBr(CondV, ThenBB, ElseBB), Site);
   
   // Emit then block.
   Builder->SetInsertPoint(ThenBB);
+  CountBranch(Site, true);
   Value *ThenV = Then->codegen();
   if (!ThenV)
     return Ast2IRError("then branch codegen failed");
+  ThenV = CreateConversion(ThenV, GetLLVMType(Ty));
   Builder->CreateBr(MergeBB);
   
   // Codegen of 'Then' can change the current block, update ThenBB for the PHI.
@@ -350,10 +942,13 @@ Value* IfExpNode::codegen() {
   //TheFunction->insert(TheFunction->end(), ElseBB);
   TheFunction->getBasicBlockList().push_back(ElseBB);
   Builder->SetInsertPoint(ElseBB);
+  EmitLocation(this);
+  CountBranch(Site, false);
 
   Value *ElseV = Else->codegen();
   if (!ElseV)
     return Ast2IRError("else branch codegen failed");
+  ElseV = CreateConversion(ElseV, GetLLVMType(Ty));
   Builder->CreateBr(MergeBB);
   
   // codegen of 'Else' can change the current block, update ElseBB for the PHI.
@@ -363,13 +958,201 @@ Value* IfExpNode::codegen() {
   //TheFunction->insert(TheFunction->end(), MergeBB);
   TheFunction->getBasicBlockList().push_back(MergeBB);
   Builder->SetInsertPoint(MergeBB);
-  PHINode *PN = Builder->CreatePHI(Type::getInt32Ty(*TheContext), 2, "iftmp");
+  EmitLocation(this);
+  PHINode *PN = Builder->CreatePHI(GetLLVMType(Ty), 2, "iftmp");
 
   PN->addIncoming(ThenV, ThenBB);
   PN->addIncoming(ElseV, ElseBB);
   return PN;
 }
 
+void IfExpNode::markTailPosition(bool tail) {
+  // The condition is never in tail position; both arms inherit ours.
+  Then->markTailPosition(tail);
+  Else->markTailPosition(tail);
+}
+
+void IfExpNode::collectCallees(std::set<std::string>& callees) const {
+  Cond->collectCallees(callees);
+  Then->collectCallees(callees);
+  Else->collectCallees(callees);
+}
+
+
+
+ForExpNode::ForExpNode(const std::string& varname,std::unique_ptr<Node> start,std::unique_ptr<Node> end,
+                       std::unique_ptr<Node> step,std::unique_ptr<Node> body)
+  : VarName(varname), Start{std::move(start)}, End{std::move(end)}, Step{std::move(step)}, Body{std::move(body)} {}
+
+void ForExpNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "ForExpNode: " << VarName << '\n';
+  OS.indent(depth+2) << "Start: " << '\n';
+  Start -> print(OS, depth+4);
+  OS.indent(depth+2) << "End: " << '\n';
+  End -> print(OS, depth+4);
+  if (Step) {
+    OS.indent(depth+2) << "Step: " << '\n';
+    Step -> print(OS, depth+4);
+  }
+  OS.indent(depth+2) << "Body: " << '\n';
+  Body -> print(OS, depth+4);
+}
+
+void ForExpNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "ForExp");
+    J.attribute("var", VarName);
+    J.attributeBegin("start");
+    PrintJsonChild(J, Start.get());
+    J.attributeEnd();
+    J.attributeBegin("end");
+    PrintJsonChild(J, End.get());
+    J.attributeEnd();
+    J.attributeBegin("step");
+    PrintJsonChild(J, Step.get());
+    J.attributeEnd();
+    J.attributeBegin("body");
+    PrintJsonChild(J, Body.get());
+    J.attributeEnd();
+  });
+}
+
+/// Loops are emitted in the shape LLVM's loop passes expect: the induction
+/// variable lives in an entry-block alloca (so mem2reg turns it into a PHI),
+/// the bounds are computed once in the preheader, and a single latch block
+/// holds the increment and the only back edge.
+Value* ForExpNode::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  Type *VarTy = GetLLVMType(getVarType());
+  bool FP = VarTy->isDoubleTy();
+  AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName, VarTy);
+  DeclareVariable(Alloca, VarName, getVarType(), this);
+
+  // Preheader: initial value and loop-invariant bounds.
+  Value *StartV = Start->codegen();
+  if (!StartV)
+    return nullptr;
+  EmitLocation(this);
+  Builder->CreateStore(CreateConversion(StartV, VarTy), Alloca);
+  Value *EndV = End->codegen();
+  if (!EndV)
+    return nullptr;
+  EndV = CreateConversion(EndV, VarTy);
+  Value *StepV = Step ? Step->codegen() : ConstantInt::get(*TheContext, APInt(32, 1));
+  if (!StepV)
+    return nullptr;
+  StepV = CreateConversion(StepV, VarTy);
+
+  BasicBlock *HeaderBB = BasicBlock::Create(*TheContext, "for.header", TheFunction);
+  BasicBlock *BodyBB = BasicBlock::Create(*TheContext, "for.body");
+  BasicBlock *LatchBB = BasicBlock::Create(*TheContext, "for.latch");
+  BasicBlock *ExitBB = BasicBlock::Create(*TheContext, "for.exit");
+  EmitLocation(this);
+  Builder->CreateBr(HeaderBB);
+
+  // Header: test the induction variable.
+  Builder->SetInsertPoint(HeaderBB);
+  Value *CurV = Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, VarName.c_str());
+  Value *CondV = FP ? Builder->CreateFCmpOLT(CurV, EndV, "forcond")
+                    : Builder->CreateICmpSLT(CurV, EndV, "forcond");
+  Builder->CreateCondBr(CondV, BodyBB, ExitBB);
+
+  // Body: the loop variable shadows any outer variable of the same name.
+  TheFunction->getBasicBlockList().push_back(BodyBB);
+  Builder->SetInsertPoint(BodyBB);
+  AllocaInst *OldVal = NamedValues[VarName];
+  NamedValues[VarName] = Alloca;
+  if (!Body->codegen())
+    return nullptr;
+  Builder->CreateBr(LatchBB);
+
+  // Latch: step and jump back.  A plain add: a step past the largest value
+  // wraps, which is defined, where an nsw one would be poison.
+  TheFunction->getBasicBlockList().push_back(LatchBB);
+  Builder->SetInsertPoint(LatchBB);
+  EmitLocation(this);
+  CurV = Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, VarName.c_str());
+  Value *NextV = FP ? Builder->CreateFAdd(CurV, StepV, "nextvar")
+                    : Builder->CreateAdd(CurV, StepV, "nextvar");
+  Builder->CreateStore(NextV, Alloca);
+  Builder->CreateBr(HeaderBB);
+
+  TheFunction->getBasicBlockList().push_back(ExitBB);
+  Builder->SetInsertPoint(ExitBB);
+  if (OldVal)
+    NamedValues[VarName] = OldVal;
+  else
+    NamedValues.erase(VarName);
+
+  return Constant::getNullValue(Type::getInt32Ty(*TheContext));
+}
+
+void ForExpNode::collectCallees(std::set<std::string>& callees) const {
+  Start->collectCallees(callees);
+  End->collectCallees(callees);
+  if (Step)
+    Step->collectCallees(callees);
+  Body->collectCallees(callees);
+}
+
+
+WhileExpNode::WhileExpNode(std::unique_ptr<Node> cond,std::unique_ptr<Node> body)
+  : Cond{std::move(cond)}, Body{std::move(body)} {}
+
+void WhileExpNode::print(raw_ostream& OS, int depth) const {
+  OS.indent(depth) << "WhileExpNode: " << '\n';
+  OS.indent(depth+2) << "Condition: " << '\n';
+  Cond -> print(OS, depth+4);
+  OS.indent(depth+2) << "Body: " << '\n';
+  Body -> print(OS, depth+4);
+}
+
+void WhileExpNode::printjson(json::OStream& J) const {
+  J.object([&] {
+    J.attribute("kind", "WhileExp");
+    J.attributeBegin("cond");
+    PrintJsonChild(J, Cond.get());
+    J.attributeEnd();
+    J.attributeBegin("body");
+    PrintJsonChild(J, Body.get());
+    J.attributeEnd();
+  });
+}
+
+Value* WhileExpNode::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  BasicBlock *HeaderBB = BasicBlock::Create(*TheContext, "while.header", TheFunction);
+  BasicBlock *BodyBB = BasicBlock::Create(*TheContext, "while.body");
+  BasicBlock *ExitBB = BasicBlock::Create(*TheContext, "while.exit");
+  EmitLocation(this);
+  Builder->CreateBr(HeaderBB);
+
+  Builder->SetInsertPoint(HeaderBB);
+  Value *CondV = Cond->codegen();
+  if (!CondV)
+    return nullptr;
+  EmitLocation(this);
+  CondV = CreateIsTrue(CondV, "whilecond");
+  Builder->CreateCondBr(CondV, BodyBB, ExitBB);
+
+  // The end of the body is the latch.
+  TheFunction->getBasicBlockList().push_back(BodyBB);
+  Builder->SetInsertPoint(BodyBB);
+  if (!Body->codegen())
+    return nullptr;
+  EmitLocation(this);
+  Builder->CreateBr(HeaderBB);
+
+  TheFunction->getBasicBlockList().push_back(ExitBB);
+  Builder->SetInsertPoint(ExitBB);
+  return Constant::getNullValue(Type::getInt32Ty(*TheContext));
+}
+
+void WhileExpNode::collectCallees(std::set<std::string>& callees) const {
+  Cond->collectCallees(callees);
+  Body->collectCallees(callees);
+}
+
 
 
 std::unique_ptr<ProgNode> InitAst() {
@@ -379,15 +1162,46 @@ std::unique_ptr<ProgNode> InitAst() {
 
 void addNode(std::unique_ptr<ProgNode>& root, std::unique_ptr<Node> node) {
     if (!root) {
-        std::cout << "root not ok" << '\n';
+        Log(2) << "root not ok" << '\n';
         root = InitAst();
     }
     root->defs.push_back(std::move(node));
-    std::cout << "root ok" << '\n';
+    Log(2) << "root ok" << '\n';
 }
 
 Value* Ast2IRError(const std::string& message){
-    std::cout << "Ast2IRError: "<< message << '\n';
+    ReportCodegenError("Ast2IRError: " + message);
     return nullptr;
 }
 
+void ReportCodegenError(const std::string& line) {
+  if (CodegenErrors)
+    *CodegenErrors += line + '\n';
+  else
+    std::cout << line << '\n';
+}
+
+
+void DumpAst(const Node& node, DumpFormat format, raw_ostream& OS) {
+    // Reused between calls so repeated dumps do not reallocate.
+    static thread_local SmallString<4096> Buffer;
+    Buffer.clear();
+    raw_svector_ostream BOS(Buffer);
+
+    if (format == DumpFormat::JSON) {
+        json::OStream J(BOS, /*IndentSize=*/2);
+        node.printjson(J);
+        BOS << '\n';
+    } else {
+        node.print(BOS);
+    }
+    OS << Buffer;
+}
+
+void DumpIR(raw_ostream& OS) {
+    static thread_local SmallString<4096> Buffer;
+    Buffer.clear();
+    raw_svector_ostream BOS(Buffer);
+    TheModule->print(BOS, nullptr);
+    OS << Buffer;
+}
@@ -5,6 +5,9 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <map>
+#include <set>
+#include "types.h"
 
 
 ///*
@@ -19,23 +22,73 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
 //*/
 
 using namespace llvm;
 
-extern std::unique_ptr<LLVMContext> TheContext;
-extern std::unique_ptr<IRBuilder<>> Builder;
-extern std::unique_ptr<Module> TheModule;
-extern std::map<std::string, AllocaInst*> NamedValues;
+class ASTWriter;
+class SourceMap;
+
+// Codegen state is per thread so independent files can be compiled in parallel.
+extern thread_local std::unique_ptr<LLVMContext> TheContext;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
+extern thread_local std::unique_ptr<Module> TheModule;
+extern thread_local std::map<std::string, AllocaInst*> NamedValues;
+
+/// BoundsChecks - Trap on out-of-range array indexes (see IndexExpNode).
+extern thread_local bool BoundsChecks;
+
+/// MaxTreeDepth - How deep an AST may be, not counting the left operands of
+/// a BinExpNode chain (see BinExpNode::chain).  Every pass over the tree
+/// recurses elsewhere, and deeper trees run out of stack on a worker thread.
+/// The parser (MaxNestingDepth) and the AST reader both stay within it.
+const unsigned MaxTreeDepth = 4096;
+
+/// Verbosity - How much progress chatter to print; 0 prints only errors.
+extern unsigned Verbosity;
+
+/// Log - outs() when Verbosity is at least level, a null stream otherwise.
+/// With BufferLog set, this thread's log is kept for TakeLog instead.
+raw_ostream& Log(unsigned level);
+
+/// BufferLog - Keep this thread's Log output; workers set it so concurrent
+/// jobs don't write outs() at once.
+extern thread_local bool BufferLog;
+
+/// TakeLog - What this thread logged since the last call.
+std::string TakeLog();
+
+/// CodegenErrors - Where codegen and type errors go on this thread, if not
+/// to std::cout: one line each.
+extern thread_local std::string* CodegenErrors;
 
 
 
 class Node{
 
 public:
+  /// Ty - The type of this node's value, filled in by inferType.
+  ValType Ty = ValType::Unknown;
+
   virtual ~Node()=default;
-  virtual void printinfo(int depth = 0) const = 0;
+  /// print - Write the indented text form of this subtree to OS.
+  virtual void print(raw_ostream& OS, int depth = 0) const = 0;
+  /// printjson - Write this subtree as one JSON value.
+  virtual void printjson(json::OStream& J) const = 0;
+  void printinfo(int depth = 0) const;
   virtual Value *codegen() = 0;
+  /// inferType - Compute Ty for this subtree (types.cpp).
+  virtual ValType inferType(TypeEnv& env) = 0;
+  /// serialize - Append this subtree in the binary AST format (serialize.cpp).
+  virtual void serialize(ASTWriter& W) const = 0;
+  /// markTailPosition - Record whether this node's value is the return value
+  /// of the enclosing function.  Only nodes that care about it override this.
+  virtual void markTailPosition(bool) {}
+  /// collectCallees - Add the name of every function called below this node.
+  virtual void collectCallees(std::set<std::string>&) const {}
 };
 
 
@@ -43,8 +96,14 @@ class ProgNode : public Node{
   
 public:
   std::vector<std::unique_ptr<Node>> defs;
+  /// Locations - Where the parser found each node, if it was asked to
+  /// record that (debuginfo.h).
+  std::shared_ptr<SourceMap> Locations;
   ProgNode(std::vector<std::unique_ptr<Node>> defs);
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value *codegen() override;
 };
 
@@ -54,8 +113,13 @@ class StmtListNode : public Node{
 public:
   std::vector<std::unique_ptr<Node>> stmts;
   StmtListNode(std::vector<std::unique_ptr<Node>> stmts);
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
+  void markTailPosition(bool tail) override;
 };
 
 class VarNode : public Node{
@@ -63,17 +127,48 @@ public:
   std::string VarName;
   
   VarNode(const std::string& name);
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
+  Value* codegen() override;
+};
+
+
+/// IndexExpNode - ArrayName[Index], an element of an array parameter.  As
+/// the left side of '=' it is stored to instead of loaded.
+class IndexExpNode : public Node{
+public:
+  std::string ArrayName;
+  std::unique_ptr<Node> Index;
+  
+  IndexExpNode(const std::string& name,std::unique_ptr<Node> index);
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  /// codegenStore - Store V, already of the element type, to the element.
+  Value* codegenStore(Value* V);
+  void collectCallees(std::set<std::string>& callees) const override;
+private:
+  /// codegenAddress - Pointer to the element, after the bounds check.
+  Value* codegenAddress();
 };
 
 
 class NumNode : public Node{
 public:
-  int NumVal;
+  int64_t NumVal = 0;  // i32 and i64 literals
+  double FPVal = 0;    // f64 literals
   
-  NumNode(int num);
-  void printinfo(int depth = 0) const override;
+  /// NumNode - An i32 literal if num fits, an i64 one otherwise.
+  NumNode(int64_t num);
+  NumNode(double num);
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
 };
 
@@ -83,30 +178,56 @@ public:
   std::unique_ptr<Node> LHS,RHS;
   
   BinExpNode(char op,std::unique_ptr<Node> lhs,std::unique_ptr<Node> rhs);
+  ~BinExpNode() override;
+
+  /// chain - This node and the BinExpNodes down its left operands, outermost
+  /// first, stopping at an assignment.  a + b + c ... folds into one, as long
+  /// as the input; passes walk it in a loop rather than recursing.
+  std::vector<BinExpNode*> chain();
+  std::vector<const BinExpNode*> chain() const;
   	
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
 
+private:
+  /// codegenOp - Apply Op to L, the LHS already emitted, and RHS.
+  Value* codegenOp(Value* L);
 };
 
 class CalleeExpNode : public Node{
 public:
   std::string Callee;
   std::vector<std::unique_ptr<Node>> CalleeArgs;
+  bool IsTail = false;
   
   CalleeExpNode(const std::string& name,std::vector<std::unique_ptr<Node>> args);
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
+  void markTailPosition(bool tail) override;
 };
 
 class LetExpNode : public Node{
 public:
   std::unique_ptr<Node> LetVar;
   std::unique_ptr<Node> LetBody;
+  ValType VarTy;  // declared type, Unknown if not annotated
   
-  LetExpNode(std::unique_ptr<Node> var,std::unique_ptr<Node> exp);
-  void printinfo(int depth = 0) const override;
+  LetExpNode(std::unique_ptr<Node> var,std::unique_ptr<Node> exp,
+             ValType varty = ValType::Unknown);
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
 };
 
 
@@ -115,12 +236,26 @@ public:
   std::string FunDefName;
   std::vector<std::string> FunDefArgs;
   std::unique_ptr<Node> FunDefBody;
+  // Declared types, Unknown where not annotated; empty FunDefArgTypes means
+  // no parameter is annotated.
+  std::vector<ValType> FunDefArgTypes;
+  ValType RetTy = ValType::Unknown;
+  bool Exported = true;
   
-  FunDefNode(const std::string& name,std::vector<std::string> args,std::unique_ptr<Node> body);
+  FunDefNode(const std::string& name,std::vector<std::string> args,std::unique_ptr<Node> body,
+             std::vector<ValType> argtys = {}, ValType retty = ValType::Unknown);
+
+  /// getArgType - Type of parameter i: declared, or i32.
+  ValType getArgType(unsigned i) const;
 
   	
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
+  Function* codegenProto();
   Function* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
 
 };
 
@@ -131,8 +266,55 @@ public:
   
   IfExpNode(std::unique_ptr<Node> cond,std::unique_ptr<Node> then,std::unique_ptr<Node> els);
   
-  void printinfo(int depth = 0) const override;
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
+  Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
+  void markTailPosition(bool tail) override;
+};
+
+
+/// ForExpNode - for Var = Start to End [step Step] in Body
+/// Runs Body with Var = Start, Start+Step, ... while Var < End.  End and Step
+/// are evaluated once, before the first iteration.  The value is 0.
+/// Step must be positive: a literal that isn't is a type error, and a
+/// computed one that isn't never reaches End.  An integer Var wraps like any
+/// other sum, so stepping past the largest value comes round below End.
+class ForExpNode : public Node{
+public:
+  std::string VarName;
+  std::unique_ptr<Node> Start,End,Step,Body;  // Step may be null (means 1)
+  
+  ForExpNode(const std::string& varname,std::unique_ptr<Node> start,std::unique_ptr<Node> end,
+             std::unique_ptr<Node> step,std::unique_ptr<Node> body);
+  /// getVarType - The loop variable's type: the widest of the bounds and step.
+  ValType getVarType() const;
+  
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
+  Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
+};
+
+
+/// WhileExpNode - while Cond do Body
+/// Re-evaluates Cond before every iteration.  The value is 0.
+class WhileExpNode : public Node{
+public:
+  std::unique_ptr<Node> Cond,Body;
+  
+  WhileExpNode(std::unique_ptr<Node> cond,std::unique_ptr<Node> body);
+  
+  void print(raw_ostream& OS, int depth = 0) const override;
+  void printjson(json::OStream& J) const override;
+  void serialize(ASTWriter& W) const override;
+  ValType inferType(TypeEnv& env) override;
   Value* codegen() override;
+  void collectCallees(std::set<std::string>& callees) const override;
 };
 
 
@@ -144,9 +326,33 @@ void addNode(std::unique_ptr<ProgNode>& root, std::unique_ptr<Node> node);
 
 Value* Ast2IRError(const std::string& message);
 
-void InitializeModule();
+/// ReportCodegenError - Print line, or add it to CodegenErrors.
+void ReportCodegenError(const std::string& line);
+
+enum class DumpFormat { Text, JSON };
+
+/// DumpAst - Render node into a reusable buffer and write it to OS at once.
+void DumpAst(const Node& node, DumpFormat format, raw_ostream& OS);
+
+/// DumpIR - Same as DumpAst, for TheModule.
+void DumpIR(raw_ostream& OS);
+
+void InitializeModule(bool ReuseContext = false);
+
+void OptimizeModule(Module& M, unsigned OptLevel, TargetMachine* TM = nullptr,
+                    bool SplitCold = false);
+
+AllocaInst* CreateEntryBlockAlloca(Function *TheFunction, const std::string &VarName, Type* Ty);
+
+/// GetLLVMType - The IR type values of t are held in.
+Type* GetLLVMType(ValType t);
+
+/// CreateConversion - V converted to To: sign extension, truncation, or
+/// signed int <-> double.
+Value* CreateConversion(Value* V, Type* To);
 
-AllocaInst* CreateEntryBlockAlloca(Function *TheFunction, const std::string &VarName);
+/// CreateIsTrue - i1 for V != 0, for conditions.
+Value* CreateIsTrue(Value* V, const Twine& Name);
 
 
 #endif
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Debug info must cost nothing when -g is off.  The plain compile has to fit
+# debuginfo.budget, a few percent over what it needed before locations were
+# tracked: spans recorded, or stored in the nodes, without -g show up there
+# (-g itself more than doubles parse memory).  It must also emit no debug
+# sections.  The times with and without -g are printed, best of three.
+#
+#   debuginfo.sh DRIVER
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk 'BEGIN {
+	for (i = 0; i < 300; i++)
+		print "def h" i "(a:[i64] n:i64):f64 { let s:i64 = 0 for j = 0 to n in" \
+		      " s = s + a[j] * " i " while s > 100 do s = s / 2" \
+		      " if s > 10 then f64(s - len(a)) else f64(s) * 1.5 + f64(a[0]) };"
+	print "$"
+}' > "$dir/dbg.k"
+
+"$driver" -O0 -mem-budget="$(dirname "$0")/debuginfo.budget" -o "$dir" "$dir/dbg.k"
+if grep -q debug_info "$dir/dbg.o"; then
+	echo "debuginfo: a compile without -g emitted debug info" >&2
+	exit 1
+fi
+
+# best OPT [-g] - Set ms to the fastest of three compiles.
+best() {
+	ms=
+	for run in 1 2 3; do
+		start=$(date +%s%N)
+		"$driver" "$@" -o "$dir" "$dir/dbg.k"
+		t=$(( ($(date +%s%N) - start) / 1000000 ))
+		[ -z "$ms" ] || [ $t -lt $ms ] && ms=$t
+	done
+	return 0
+}
+
+printf '%4s %8s %8s\n' opt plain -g
+for opt in -O0 -O2; do
+	best $opt
+	plain=$ms
+	best $opt -g
+	printf '%4s %6dms %6dms\n' $opt $plain $ms
+	if ! grep -q debug_info "$dir/dbg.o"; then
+		echo "debuginfo: $opt -g emitted no debug info" >&2
+		exit 1
+	fi
+done
@@ -0,0 +1,36 @@
+#!/bin/sh
+# The same kernels written as tail recursion and as for loops, run in the
+# JIT at -O0 and -O2.  Both forms must agree, and at -O2 the loop passes
+# must still reduce the integer sum loop to its closed form.
+#
+#   loops.sh JIT
+set -e
+jit=$1
+prog=$(dirname "$0")/loops.k
+n=300000000
+
+# run OPT FUNCTION - Print FUNCTION's result and set ms to its run time.
+run() {
+	start=$(date +%s%N)
+	result=$("$jit" -$1 "$prog" $2 $n)
+	ms=$(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+printf '%-8s %4s %10s %10s\n' kernel opt recursive loop
+for kernel in sum series; do
+	for opt in O0 O2; do
+		run $opt ${kernel}call; rec=$ms; expect=$result
+		run $opt ${kernel}loop; loop=$ms
+		printf '%-8s %4s %8dms %8dms\n' $kernel $opt $rec $loop
+		if [ "$result" != "$expect" ]; then
+			echo "loops: $kernel at -$opt: loop gave $result, recursion $expect" >&2
+			exit 1
+		fi
+		[ $kernel = sum ] && eval sum$opt=$loop
+	done
+done
+
+if [ $((sumO2 * 5)) -gt $sumO0 ]; then
+	echo "loops: the sum loop is no longer folded at -O2" >&2
+	exit 1
+fi
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Memory by compiler phase on a fixed generated program, checked against
+# memory.budget.  Raise a budget only for a growth you meant; lower it when
+# a change saves memory, so the gain is kept.
+#
+#   memory.sh DRIVER
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# A loop kernel and 100 callers with loops, branches, conversions and
+# array accesses.
+awk 'BEGIN {
+	print "def sum(a:[i64] n:i64):i64 { let s:i64 = 0 for j = 0 to n in s = s + a[j] s };"
+	for (i = 0; i < 100; i++)
+		print "def h" i "(a:[i64] n:i64):f64 { let s:i64 = sum(a n) * " i \
+		      " while s > 100 do s = s / 2 if s > 10 then f64(s - len(a))" \
+		      " else f64(s) * 1.5 + f64(a[0]) };"
+	print "$"
+}' > "$dir/mem.k"
+
+"$driver" -O2 -mem-report -mem-budget="$(dirname "$0")/memory.budget" -o "$dir" "$dir/mem.k"
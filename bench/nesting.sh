@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compile time against expression nesting depth.  Every program has the same
+# number of tokens, spread over fewer and deeper functions, so a parser that
+# is linear in its input takes about as long on each.
+#
+#   nesting.sh DRIVER
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Each level is a parenthesis, one of the parser's MaxNestingDepth (2000);
+# the fold inside it doesn't count.
+total=90000
+min= max=
+printf '%8s %10s %8s\n' depth functions ms
+for depth in 10 100 300 900; do
+	count=$((total / depth))
+	awk -v d=$depth -v k=$count 'BEGIN {
+		for (i = 0; i < k; i++) {
+			s = "def g" i "(x) "
+			for (j = 0; j < d; j++) s = s "(x + "
+			s = s "x"
+			for (j = 0; j < d; j++) s = s ")"
+			print s ";"
+		}
+		print "$"
+	}' > "$dir/nest$depth.k"
+	start=$(date +%s%N)
+	"$driver" -O0 -o "$dir" "$dir/nest$depth.k"
+	ms=$(( ($(date +%s%N) - start) / 1000000 ))
+	printf '%8d %10d %8d\n' $depth $count $ms
+	[ -z "$min" ] || [ $ms -lt $min ] && min=$ms
+	[ -z "$max" ] || [ $ms -gt $max ] && max=$ms
+done
+
+# Quadratic nesting would be 90 times slower at depth 900 than at 10.
+if [ $max -gt $((min * 3)) ]; then
+	echo "nesting: slowest depth took more than 3x the fastest" >&2
+	exit 1
+fi
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Wall time of one compile split into N partitions on N threads, for N from
+# 1 to 4, with the speedup over N = 1.  On fewer cores than N the extra
+# partitions only cost; the check is that they never cost more than half
+# again the unsplit compile.
+#
+#   scaling.sh DRIVER
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Independent functions, so every partition gets a share.
+awk 'BEGIN {
+	for (i = 0; i < 400; i++)
+		print "def h" i "(a:[i64] n:i64):f64 { let s:i64 = 0 for j = 0 to n in" \
+		      " s = s + a[j] * " i " while s > 100 do s = s / 2" \
+		      " if s > 10 then f64(s - len(a)) else f64(s) * 1.5 + f64(a[0]) };"
+	print "$"
+}' > "$dir/split.k"
+
+echo "$(nproc) cores"
+printf '%8s %8s %8s\n' threads ms speedup
+for n in 1 2 3 4; do
+	start=$(date +%s%N)
+	if [ $n = 1 ]; then
+		"$driver" -O2 -j 1 -o "$dir" "$dir/split.k"
+	else
+		"$driver" -O2 -j $n -split $n -o "$dir" "$dir/split.k"
+	fi
+	ms=$(( ($(date +%s%N) - start) / 1000000 ))
+	[ $n = 1 ] && base=$ms
+	printf '%8d %8d %8s\n' $n $ms $(awk -v b=$base -v t=$ms 'BEGIN { printf "%.2f", b / t }')
+	if [ $((ms * 2)) -gt $((base * 3)) ]; then
+		echo "scaling: $n partitions took more than 1.5x the unsplit compile" >&2
+		exit 1
+	fi
+done
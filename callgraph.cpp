@@ -0,0 +1,46 @@
+#include "callgraph.h"
+
+
+AstCallGraph::AstCallGraph(const ProgNode& prog) {
+  for (const auto& def : prog.defs) {
+    const FunDefNode* fun = static_cast<const FunDefNode*>(def.get());
+    def->collectCallees(Callees[fun->FunDefName]);
+  }
+}
+
+std::set<std::string> AstCallGraph::reachableFrom(const std::set<std::string>& roots) const {
+  std::set<std::string> reached;
+  std::vector<std::string> worklist(roots.begin(), roots.end());
+  
+  while (!worklist.empty()) {
+    std::string name = worklist.back();
+    worklist.pop_back();
+    
+    // Calls to functions defined elsewhere are not part of the graph.
+    auto it = Callees.find(name);
+    if (it == Callees.end() || !reached.insert(name).second)
+      continue;
+    
+    for (const auto& callee : it->second)
+      worklist.push_back(callee);
+  }
+  return reached;
+}
+
+
+void PruneProgram(ProgNode& prog, const std::set<std::string>& exports) {
+  if (exports.empty())
+    return;
+  
+  std::set<std::string> live = AstCallGraph(prog).reachableFrom(exports);
+  
+  std::vector<std::unique_ptr<Node>> kept;
+  for (auto& def : prog.defs) {
+    FunDefNode* fun = static_cast<FunDefNode*>(def.get());
+    if (!live.count(fun->FunDefName))
+      continue;
+    fun->Exported = exports.count(fun->FunDefName) != 0;
+    kept.push_back(std::move(def));
+  }
+  prog.defs = std::move(kept);
+}
@@ -0,0 +1,27 @@
+#ifndef Z_CALLGRAPH_H
+#define Z_CALLGRAPH_H
+
+#include "ast.h"
+
+
+/// AstCallGraph - Which functions each definition of a program calls, built
+/// from the CalleeExpNodes in the AST before any IR exists.
+class AstCallGraph {
+public:
+  std::map<std::string, std::set<std::string>> Callees;
+
+  AstCallGraph(const ProgNode& prog);
+
+  /// reachableFrom - Every defined function that can be called, directly or
+  /// transitively, starting from one of roots (roots included).
+  std::set<std::string> reachableFrom(const std::set<std::string>& roots) const;
+};
+
+
+/// PruneProgram - Drop the definitions that cannot be reached from exports
+/// and give the survivors that are not exported internal linkage.  An empty
+/// export set keeps the whole program exported, as before.
+void PruneProgram(ProgNode& prog, const std::set<std::string>& exports);
+
+
+#endif
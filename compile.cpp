@@ -0,0 +1,339 @@
+#include "compile.h"
+#include "callgraph.h"
+#include "debuginfo.h"
+#include "memstats.h"
+#include "parser.h"
+#include "profile.h"
+#include "serialize.h"
+#include "split.h"
+#include "threadpool.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/xxhash.h"
+#include <mutex>
+#include <optional>
+
+
+void InitializeCompilerTargets() {
+  static std::once_flag Once;
+  std::call_once(Once, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+  });
+}
+
+TargetMachine* GetTargetMachine(unsigned OptLevel, std::string& error) {
+  static thread_local std::map<unsigned, std::unique_ptr<TargetMachine>> Machines;
+  auto& TM = Machines[OptLevel];
+  if (TM)
+    return TM.get();
+
+  InitializeCompilerTargets();
+  std::string Triple = sys::getDefaultTargetTriple();
+  const Target* T = TargetRegistry::lookupTarget(Triple, error);
+  if (!T)
+    return nullptr;
+
+  CodeGenOpt::Level Level = OptLevel == 0 ? CodeGenOpt::None
+                          : OptLevel == 1 ? CodeGenOpt::Less
+                          : OptLevel == 2 ? CodeGenOpt::Default
+                                          : CodeGenOpt::Aggressive;
+  TM.reset(T->createTargetMachine(Triple, sys::getHostCPUName(), "", TargetOptions(),
+                                  Reloc::PIC_, None, Level));
+  return TM.get();
+}
+
+
+/// AstCacheFile - Where cachedir keeps the AST of input: one file per
+/// absolute path.  The file records the source hash it was parsed from.
+static std::string AstCacheFile(const std::string& cachedir, const std::string& input) {
+  SmallString<256> Abs(input);
+  sys::fs::make_absolute(Abs);
+  SmallString<256> Path(cachedir);
+  sys::path::append(Path, utohexstr(xxHash64(Abs), /*LowerCase=*/true) + ".kast");
+  return std::string(Path);
+}
+
+std::unique_ptr<ProgNode> ParseFile(const std::string& input, std::string& error,
+                                    bool locations, const std::string* source,
+                                    const std::string& cachedir) {
+  // The lexer exits the process on unreadable files; check first so one bad
+  // input only fails its own job.
+  if (!source && !sys::fs::is_regular_file(input)) {
+    error = "cannot read " + input;
+    return nullptr;
+  }
+
+  // A cached AST must match the text, so the text is read, hashed and
+  // parsed from memory.
+  std::string text, cachefile;
+  uint64_t Hash = 0;
+  if (!cachedir.empty()) {
+    if (!source) {
+      auto Buf = MemoryBuffer::getFile(input);
+      if (!Buf) {
+        error = "cannot read " + input;
+        return nullptr;
+      }
+      text = (*Buf)->getBuffer().str();
+      source = &text;
+    }
+    Hash = xxHash64(*source);
+    cachefile = AstCacheFile(cachedir, input);
+    if (!locations) {
+      std::string LoadError;
+      if (auto Root = LoadAst(cachefile, LoadError, Hash)) {
+        Log(1) << input << ": AST loaded from " << cachefile << '\n';
+        return Root;
+      }
+      Log(2) << LoadError << '\n';
+    }
+  }
+
+  if (MemTrackingEnabled()) {
+    uint64_t Size;
+    if (source)
+      AddSourceBytes(source->size());
+    else if (!sys::fs::file_size(input, Size))
+      AddSourceBytes(Size);
+  }
+
+  // The parser lexes the whole file up front.
+  std::optional<Parser> parser;
+  {
+    MemPhaseScope Phase(MemPhase::Lex);
+    parser.emplace(input, locations, source);
+  }
+  MemPhaseScope Phase(MemPhase::Parse);
+  if (!parser->ParseProgram()) {
+    raw_string_ostream OS(error);
+    OS << "parse failed\n";
+    parser->PrintDiagnostics(OS);
+    OS.flush();
+    if (!error.empty() && error.back() == '\n')
+      error.pop_back();
+    return nullptr;
+  }
+  auto Root = parser->getRoot();
+  if (!cachefile.empty() && !SaveAst(*Root, cachefile, Hash))
+    Log(1) << cachefile << ": can't write the AST cache\n";
+  return Root;
+}
+
+/// CodegenModule - GenerateModule up to optimization.  Returns the target
+/// machine, or nullptr and sets error.
+static TargetMachine* CodegenModule(ProgNode& prog, const std::string& moduleName,
+                                    const CompileOptions& opts, std::string& error) {
+  TargetMachine* TM = GetTargetMachine(opts.OptLevel, error);
+  if (!TM)
+    return nullptr;
+
+  Profiling.Module = sys::path::filename(moduleName).str();
+  Profiling.Instrument = opts.ProfileGenerate;
+  Profiling.Use = opts.ProfileUse;
+  Profiling.Timing = opts.TimeProfile;
+  BoundsChecks = opts.BoundsChecks == CheckMode::Default ? opts.OptLevel < 3
+                                                        : opts.BoundsChecks == CheckMode::On;
+
+  MemPhaseScope Phase(MemPhase::Codegen);
+  PruneProgram(prog, opts.Exports);
+
+  InitializeModule(opts.ReuseContext);
+  TheModule->setModuleIdentifier(moduleName);
+  TheModule->setSourceFileName(moduleName);
+  TheModule->setTargetTriple(TM->getTargetTriple().str());
+  TheModule->setDataLayout(TM->createDataLayout());
+
+  if (opts.DebugInfo && prog.Locations)
+    BeginDebugInfo(*prog.Locations, opts.OptLevel > 0);
+  // Errors are the compile's, not this thread's stdout's.
+  std::string Errors;
+  CodegenErrors = &Errors;
+  bool Ok = prog.codegen() != nullptr;
+  CodegenErrors = nullptr;
+  FinishDebugInfo();
+  if (!Ok) {
+    error = "codegen failed";
+    SmallVector<StringRef, 4> Lines;
+    StringRef(Errors).split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines)
+      error += "\n" + moduleName + ": " + Line.str();
+  }
+
+  raw_string_ostream VerifyOS(error);
+  if (Ok && verifyModule(*TheModule, &VerifyOS)) {
+    VerifyOS.flush();
+    Ok = false;
+  }
+
+  Profiling = ProfileOptions();
+  return Ok ? TM : nullptr;
+}
+
+bool GenerateModule(ProgNode& prog, const std::string& moduleName,
+                    const CompileOptions& opts, std::string& error) {
+  TargetMachine* TM = CodegenModule(prog, moduleName, opts, error);
+  if (!TM)
+    return false;
+  MemPhaseScope Phase(MemPhase::Optimize);
+  OptimizeModule(*TheModule, opts.OptLevel, TM, opts.ProfileUse != nullptr);
+  return true;
+}
+
+bool GeneratePartitions(ProgNode& prog, const std::string& moduleName,
+                        const CompileOptions& opts, std::vector<ModulePartition>& parts,
+                        std::string& error, const PartitionCallback& each) {
+  // Partitions move to contexts of their own as bitcode, so that each can
+  // be worked on by another thread.
+  std::vector<SmallVector<char, 0>> Bitcode;
+  bool Ok = CodegenModule(prog, moduleName, opts, error) != nullptr;
+  if (Ok) {
+    MemPhaseScope Phase(MemPhase::Codegen);
+    for (auto& Part : SplitModuleByCalls(*TheModule, opts.Partitions)) {
+      Bitcode.emplace_back();
+      raw_svector_ostream OS(Bitcode.back());
+      WriteBitcodeToFile(*Part, OS);
+    }
+  }
+  ReleaseModule(opts.ReuseContext);
+  if (!Ok)
+    return false;
+
+  parts.clear();
+  parts.resize(Bitcode.size());
+  std::vector<std::string> Errors(Bitcode.size());
+  auto Work = [&](unsigned i) {
+    ModulePartition& P = parts[i];
+    std::string& Error = Errors[i];
+    P.Context = std::make_unique<LLVMContext>();
+    StringRef Buf(Bitcode[i].data(), Bitcode[i].size());
+    auto M = parseBitcodeFile(MemoryBufferRef(Buf, moduleName + "." + std::to_string(i)),
+                              *P.Context);
+    if (!M) {
+      Error = toString(M.takeError());
+      return;
+    }
+    P.M = std::move(*M);
+    TargetMachine* TM = GetTargetMachine(opts.OptLevel, Error);
+    if (!TM)
+      return;
+    {
+      MemPhaseScope Phase(MemPhase::Optimize);
+      OptimizeModule(*P.M, opts.OptLevel, TM, opts.ProfileUse != nullptr);
+    }
+    if (each && !each(P, i, Error) && Error.empty())
+      Error = "partition " + std::to_string(i) + " failed";
+  };
+  // On a worker (a Driver job), share its pool: its threads already have
+  // target machines, and a pool per job would multiply the threads.
+  if (WorkStealingPool* Shared = WorkStealingPool::current()) {
+    Shared->runAll(Bitcode.size(), Work);
+  } else {
+    WorkStealingPool Pool(Bitcode.size());
+    Pool.runAll(Bitcode.size(), Work);
+  }
+
+  for (const std::string& E : Errors)
+    if (!E.empty()) {
+      error = E;
+      return false;
+    }
+  return true;
+}
+
+void ReleaseModule(bool reuseContext) {
+  Builder.reset();
+  TheModule.reset();
+  if (!reuseContext)
+    TheContext.reset();
+}
+
+/// EmitModule - Append M to out as an object file, or as bitcode with
+/// opts.EmitBitcode.
+static bool EmitModule(Module& M, const CompileOptions& opts, SmallVectorImpl<char>& out,
+                       std::string& error) {
+  raw_svector_ostream OS(out);
+  if (opts.EmitBitcode) {
+    WriteBitcodeToFile(M, OS);
+    return true;
+  }
+  TargetMachine* TM = GetTargetMachine(opts.OptLevel, error);
+  if (!TM)
+    return false;
+  legacy::PassManager PM;
+  if (TM->addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile)) {
+    error = "target cannot emit object files";
+    return false;
+  }
+  PM.run(M);
+  return true;
+}
+
+bool EmitProgramToBuffer(ProgNode& prog, const std::string& moduleName,
+                         const CompileOptions& opts, std::string& error,
+                         SmallVectorImpl<char>& out,
+                         SmallVectorImpl<char>* bitcode) {
+  bool Ok = GenerateModule(prog, moduleName, opts, error);
+
+  MemPhaseScope Phase(MemPhase::Emit);
+  if (Ok && bitcode) {
+    raw_svector_ostream BOS(*bitcode);
+    WriteBitcodeToFile(*TheModule, BOS);
+  }
+
+  if (Ok)
+    Ok = EmitModule(*TheModule, opts, out, error);
+
+  ReleaseModule(opts.ReuseContext);
+  return Ok;
+}
+
+bool EmitPartitionsToBuffers(ProgNode& prog, const std::string& moduleName,
+                             const CompileOptions& opts, std::string& error,
+                             std::vector<SmallVector<char, 0>>& outs) {
+  std::vector<ModulePartition> Parts;
+  outs.clear();
+  outs.resize(std::max(opts.Partitions, 1u));
+  return GeneratePartitions(prog, moduleName, opts, Parts, error,
+    [&](ModulePartition& part, unsigned i, std::string& error) {
+      MemPhaseScope Phase(MemPhase::Emit);
+      bool Ok = EmitModule(*part.M, opts, outs[i], error);
+      // Done with it; don't hold every partition until the last finishes.
+      part.M.reset();
+      part.Context.reset();
+      return Ok;
+    });
+}
+
+bool EmitProgram(ProgNode& prog, const std::string& moduleName, const std::string& output,
+                 const CompileOptions& opts, std::string& error,
+                 SmallVectorImpl<char>* bitcode) {
+  SmallVector<char, 0> Out;
+  if (!EmitProgramToBuffer(prog, moduleName, opts, error, Out, bitcode))
+    return false;
+  return WriteFile(output, StringRef(Out.data(), Out.size()), error);
+}
+
+bool WriteFile(const std::string& filename, StringRef data, std::string& error) {
+  std::error_code EC;
+  raw_fd_ostream OS(filename, EC, sys::fs::OF_None);
+  if (EC) {
+    error = filename + ": " + EC.message();
+    return false;
+  }
+  OS << data;
+  OS.close();
+  if (OS.has_error()) {
+    error = filename + ": " + OS.error().message();
+    OS.clear_error();
+    return false;
+  }
+  return true;
+}
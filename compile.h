@@ -0,0 +1,112 @@
+#ifndef Z_COMPILE_H
+#define Z_COMPILE_H
+
+#include "ast.h"
+#include "profile.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Target/TargetMachine.h"
+#include <functional>
+
+
+enum class CheckMode { Default, On, Off };
+
+struct CompileOptions {
+  unsigned OptLevel = 0;
+  /// EmitBitcode - Write LLVM bitcode instead of a native object file.
+  bool EmitBitcode = false;
+  /// Exports - Entry points handed to PruneProgram; empty exports everything.
+  std::set<std::string> Exports;
+  /// ReuseContext - Keep this thread's LLVMContext for the next compile.
+  bool ReuseContext = false;
+  /// ProfileGenerate - Instrument branches and calls (see profile.h).
+  bool ProfileGenerate = false;
+  /// ProfileUse - Counts to optimize with (see LoadProfile), if any.
+  const ProfileCounts* ProfileUse = nullptr;
+  /// TimeProfile - Time every function call for the runtime's report.
+  bool TimeProfile = false;
+  /// BoundsChecks - Trap on out-of-range array indexes.  By default only
+  /// below -O3.
+  CheckMode BoundsChecks = CheckMode::Default;
+  /// Partitions - How many modules GeneratePartitions splits a program into.
+  unsigned Partitions = 1;
+  /// DebugInfo - Emit DWARF for programs parsed with locations (see
+  /// debuginfo.h).
+  bool DebugInfo = false;
+};
+
+/// ModulePartition - One module of a split program, in a context of its own.
+struct ModulePartition {
+  std::unique_ptr<LLVMContext> Context;
+  std::unique_ptr<Module> M;
+};
+
+/// PartitionCallback - Work on partition number i; false and error if it
+/// fails.
+typedef std::function<bool(ModulePartition& part, unsigned i, std::string& error)>
+  PartitionCallback;
+
+
+/// InitializeCompilerTargets - Register the native target.  Safe to call
+/// from several threads; only the first call does anything.
+void InitializeCompilerTargets();
+
+/// GetTargetMachine - This thread's host TargetMachine for OptLevel.  Target
+/// machines are not shared between threads, and are kept for reuse.
+TargetMachine* GetTargetMachine(unsigned OptLevel, std::string& error);
+
+/// ParseFile - Lex and parse input, recording source locations if asked.
+/// source, if given, is input's text, already read.  With a cachedir, the
+/// AST of an unchanged input is loaded from there instead (see
+/// serialize.h), and a fresh parse is stored; the cache keeps no locations,
+/// so a parse with locations never reads it.  Returns nullptr and sets
+/// error on failure.
+std::unique_ptr<ProgNode> ParseFile(const std::string& input, std::string& error,
+                                    bool locations = false,
+                                    const std::string* source = nullptr,
+                                    const std::string& cachedir = std::string());
+
+/// GenerateModule - Generate and optimize code for prog on this thread,
+/// leaving it in TheModule (and TheContext).  Returns false and sets error
+/// on failure.
+bool GenerateModule(ProgNode& prog, const std::string& moduleName,
+                    const CompileOptions& opts, std::string& error);
+
+/// GeneratePartitions - Generate code for prog, split it into
+/// opts.Partitions modules by call graph (split.h) and optimize each on a
+/// thread of its own, which then passes it to each if given.  The same
+/// program and options always give the same partitions.  Returns false and
+/// sets error on failure.
+bool GeneratePartitions(ProgNode& prog, const std::string& moduleName,
+                        const CompileOptions& opts, std::vector<ModulePartition>& parts,
+                        std::string& error, const PartitionCallback& each = nullptr);
+
+/// ReleaseModule - Drop this thread's IR now rather than when it next
+/// compiles.
+void ReleaseModule(bool reuseContext);
+
+/// EmitProgramToBuffer - Generate code for prog on this thread and append
+/// the object file (or bitcode) to out.  If bitcode is not null it also gets
+/// the module as bitcode, for linking.  Returns false and sets error on
+/// failure.
+bool EmitProgramToBuffer(ProgNode& prog, const std::string& moduleName,
+                         const CompileOptions& opts, std::string& error,
+                         SmallVectorImpl<char>& out,
+                         SmallVectorImpl<char>* bitcode = nullptr);
+
+/// EmitPartitionsToBuffers - GeneratePartitions, emitting each partition's
+/// object file (or bitcode) into outs on its thread.  outs gets exactly
+/// opts.Partitions entries, some of them possibly empty modules.
+bool EmitPartitionsToBuffers(ProgNode& prog, const std::string& moduleName,
+                             const CompileOptions& opts, std::string& error,
+                             std::vector<SmallVector<char, 0>>& outs);
+
+/// EmitProgram - EmitProgramToBuffer, then write the result to output.
+bool EmitProgram(ProgNode& prog, const std::string& moduleName, const std::string& output,
+                 const CompileOptions& opts, std::string& error,
+                 SmallVectorImpl<char>* bitcode = nullptr);
+
+/// WriteFile - Replace filename with data.
+bool WriteFile(const std::string& filename, StringRef data, std::string& error);
+
+
+#endif
@@ -0,0 +1,138 @@
+#include "debuginfo.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+
+thread_local DebugInfoBuilder* TheDebugInfo = nullptr;
+
+class DebugInfoBuilder {
+public:
+  const SourceMap& Locs;
+  DIBuilder DIB;
+  DIFile* File;
+  DICompileUnit* CU;
+  /// SP - The function being generated.
+  DISubprogram* SP = nullptr;
+  std::map<ValType, DIType*> Types;
+
+  DebugInfoBuilder(const SourceMap& locs, bool optimized)
+    : Locs(locs), DIB(*TheModule) {
+    SmallString<128> Path(locs.Filename);
+    sys::fs::make_absolute(Path);
+    File = DIB.createFile(sys::path::filename(Path), sys::path::parent_path(Path));
+    CU = DIB.createCompileUnit(dwarf::DW_LANG_C, File, "Kaleidoscope Compiler", optimized,
+                               "", 0);
+  }
+
+  int lineOf(const Node* node) const {
+    const SourceRange* R = Locs.lookup(node);
+    return R ? R->Line : 0;
+  }
+
+  DIType* getType(ValType t) {
+    DIType*& T = Types[t];
+    if (T)
+      return T;
+    switch (t) {
+    case ValType::I64:
+      T = DIB.createBasicType("i64", 64, dwarf::DW_ATE_signed);
+      break;
+    case ValType::F64:
+      T = DIB.createBasicType("f64", 64, dwarf::DW_ATE_float);
+      break;
+    case ValType::ArrI32:
+    case ValType::ArrI64:
+    case ValType::ArrF64: {
+      // What an array variable holds: { element*, i64 length }.
+      DIType* Data = DIB.createPointerType(getType(ElementType(t)), 64);
+      DIType* Len = getType(ValType::I64);
+      Metadata* Members[] = {
+        DIB.createMemberType(CU, "data", File, 0, 64, 64, 0, DINode::FlagZero, Data),
+        DIB.createMemberType(CU, "len", File, 0, 64, 64, 64, DINode::FlagZero, Len)};
+      T = DIB.createStructType(CU, TypeName(t), File, 0, 128, 64, DINode::FlagZero, nullptr,
+                               DIB.getOrCreateArray(Members));
+      break;
+    }
+    default:
+      T = DIB.createBasicType("i32", 32, dwarf::DW_ATE_signed);
+      break;
+    }
+    return T;
+  }
+};
+
+
+void BeginDebugInfo(const SourceMap& locs, bool optimized) {
+  TheModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+  TheModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+  TheDebugInfo = new DebugInfoBuilder(locs, optimized);
+}
+
+void FinishDebugInfo() {
+  if (!TheDebugInfo)
+    return;
+  TheDebugInfo->DIB.finalize();
+  delete TheDebugInfo;
+  TheDebugInfo = nullptr;
+}
+
+void BeginFunctionDebugInfo(const FunDefNode& def, Function* F) {
+  DebugInfoBuilder* DI = TheDebugInfo;
+  if (!DI)
+    return;
+  // The IR signature: an array is its data pointer and length.
+  SmallVector<Metadata*, 8> Sig{DI->getType(def.Ty)};
+  for (unsigned i = 0; i != def.FunDefArgs.size(); ++i) {
+    ValType T = def.getArgType(i);
+    if (IsArray(T)) {
+      Sig.push_back(DI->DIB.createPointerType(DI->getType(ElementType(T)), 64));
+      Sig.push_back(DI->getType(ValType::I64));
+    } else {
+      Sig.push_back(DI->getType(T));
+    }
+  }
+  int Line = DI->lineOf(&def);
+  DISubprogram::DISPFlags Flags = DISubprogram::SPFlagDefinition;
+  if (DI->CU->isOptimized())
+    Flags |= DISubprogram::SPFlagOptimized;
+  DI->SP = DI->DIB.createFunction(DI->File, def.FunDefName, StringRef(), DI->File, Line,
+                                  DI->DIB.createSubroutineType(
+                                    DI->DIB.getOrCreateTypeArray(Sig)),
+                                  Line, DINode::FlagPrototyped, Flags);
+  F->setSubprogram(DI->SP);
+  // The prologue is placed at the definition.
+  SetDebugLocation(&def);
+}
+
+void EndFunctionDebugInfo() {
+  DebugInfoBuilder* DI = TheDebugInfo;
+  if (!DI || !DI->SP)
+    return;
+  DI->DIB.finalizeSubprogram(DI->SP);
+  DI->SP = nullptr;
+  Builder->SetCurrentDebugLocation(DebugLoc());
+}
+
+void SetDebugLocation(const Node* node) {
+  DebugInfoBuilder* DI = TheDebugInfo;
+  const SourceRange* R = DI->SP ? DI->Locs.lookup(node) : nullptr;
+  if (R)
+    Builder->SetCurrentDebugLocation(DILocation::get(*TheContext, R->Line, R->Col, DI->SP));
+}
+
+void DeclareDebugVariable(AllocaInst* slot, const std::string& name, ValType t,
+                          const Node* at, unsigned argNo) {
+  DebugInfoBuilder* DI = TheDebugInfo;
+  if (!DI->SP)
+    return;
+  const SourceRange* R = DI->Locs.lookup(at);
+  int Line = R ? R->Line : 0;
+  DILocalVariable* Var =
+    argNo ? DI->DIB.createParameterVariable(DI->SP, name, argNo, DI->File, Line,
+                                            DI->getType(t), true)
+          : DI->DIB.createAutoVariable(DI->SP, name, DI->File, Line, DI->getType(t), true);
+  DI->DIB.insertDeclare(slot, Var, DI->DIB.createExpression(),
+                        DILocation::get(*TheContext, Line, R ? R->Col : 0, DI->SP),
+                        Builder->GetInsertBlock());
+}
@@ -0,0 +1,94 @@
+#ifndef Z_DEBUGINFO_H
+#define Z_DEBUGINFO_H
+
+#include "ast.h"
+#include "llvm/ADT/DenseMap.h"
+
+/*
+ * Source locations and debug info.
+ *
+ * Asked to, the parser records where each node's text begins and ends.  The
+ * ranges are kept in a SourceMap beside the tree (ProgNode::Locations), so
+ * nodes are no bigger for them and a parse that doesn't ask does no extra
+ * work.
+ *
+ * With locations and CompileOptions::DebugInfo, codegen emits DWARF: a
+ * compile unit for the module, a subprogram for each function, parameters,
+ * lets and loop variables as its variables, and the line and column of the
+ * node every instruction was generated for.  KaleidoscopeJIT can register
+ * the code with GDB's JIT interface, and perf's jitdump takes the line
+ * table too.  Without debug info the codegen hooks are a test of
+ * TheDebugInfo each.
+ *
+ * The binary AST format (serialize.h) does not keep locations; code from a
+ * loaded tree gets no debug info.
+ */
+
+/// SourceRange - A node's text: its first character and one past its last,
+/// 1-based.
+struct SourceRange {
+  int Line = 0, Col = 0;
+  int EndLine = 0, EndCol = 0;
+};
+
+/// SourceMap - The source ranges of a program's nodes.
+class SourceMap {
+  DenseMap<const Node*, SourceRange> Ranges;
+
+public:
+  std::string Filename;
+
+  explicit SourceMap(std::string filename) : Filename(std::move(filename)) {}
+
+  /// add - Record node's range, replacing any left by a node that was
+  /// freed at the same address.
+  void add(const Node* node, const SourceRange& range) { Ranges[node] = range; }
+
+  /// lookup - node's range, or nullptr.
+  const SourceRange* lookup(const Node* node) const {
+    auto It = Ranges.find(node);
+    return It == Ranges.end() ? nullptr : &It->second;
+  }
+
+  size_t size() const { return Ranges.size(); }
+};
+
+
+class DebugInfoBuilder;
+
+/// TheDebugInfo - What this thread is describing TheModule with, if anything.
+extern thread_local DebugInfoBuilder* TheDebugInfo;
+
+/// BeginDebugInfo - Describe the code generated into TheModule from now on,
+/// placing nodes with locs.
+void BeginDebugInfo(const SourceMap& locs, bool optimized);
+
+/// FinishDebugInfo - Complete the module's debug info and stop.
+void FinishDebugInfo();
+
+/// BeginFunctionDebugInfo - Give F, just created for def, its subprogram.
+/// Code emitted next is placed at def.
+void BeginFunctionDebugInfo(const FunDefNode& def, Function* F);
+
+/// EndFunctionDebugInfo - F is complete (or deleted).
+void EndFunctionDebugInfo();
+
+void SetDebugLocation(const Node* node);
+void DeclareDebugVariable(AllocaInst* slot, const std::string& name, ValType t,
+                          const Node* at, unsigned argNo);
+
+/// EmitLocation - Place the instructions Builder emits next at node.
+inline void EmitLocation(const Node* node) {
+  if (TheDebugInfo)
+    SetDebugLocation(node);
+}
+
+/// DeclareVariable - Describe slot as variable name of type t, declared at
+/// node at; parameter argNo (from 1) if that isn't 0.
+inline void DeclareVariable(AllocaInst* slot, const std::string& name, ValType t,
+                            const Node* at, unsigned argNo = 0) {
+  if (TheDebugInfo)
+    DeclareDebugVariable(slot, name, t, at, argNo);
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "compile.h"
+#include "memstats.h"
+#include "threadpool.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+
+static void Usage() {
+	errs() << "usage: Driver [options] <file or directory>...\n"
+	       << "  -j N          compile N files at a time (default: all cores)\n"
+	       << "  -O0..-O3      optimization level (default: -O0)\n"
+	       << "  -emit-llvm    write bitcode (.bc) instead of objects (.o)\n"
+	       << "  -o DIR        put outputs in DIR instead of next to the inputs, below\n"
+	       << "                it as they are below a directory argument\n"
+	       << "  -link FILE    also link every input into one bitcode module\n"
+	       << "  -ast-cache DIR  keep parsed ASTs in DIR; unchanged inputs skip parsing\n"
+	       << "  -split N      split each input by call graph into N objects\n"
+	       << "                (<name>.0.o ...), optimized and emitted in parallel\n"
+	       << "  -export NAME  keep NAME external; may repeat (default: all)\n"
+	       << "  -fprofile-generate  count branches and calls; link libKProfRuntime.a\n"
+	       << "  -fprofile-use=FILE  optimize with the counts in FILE\n"
+	       << "  -pg           time every call; link libKProfRuntime.a\n"
+	       << "  -f[no-]bounds-check  check array indexes (default: below -O3)\n"
+	       << "  -g            emit DWARF debug info\n"
+	       << "  -mem-report   print memory allocated in each compiler phase\n"
+	       << "  -mem-budget=FILE  fail if a phase uses more memory than FILE allows\n"
+	       << "  -v            print progress; repeat for parser chatter\n";
+}
+
+/// CollectInputs - Expand directories into the Kaleidoscope sources (*.k)
+/// below them; a file named on its own is compiled whatever it is called.
+/// names gets where each goes under -o DIR: a file's name, or its path
+/// below the directory it was found in.
+static void CollectInputs(const std::string& path, std::vector<std::string>& inputs,
+                          std::vector<std::string>& names) {
+	if (!sys::fs::is_directory(path)) {
+		inputs.push_back(path);
+		names.push_back(sys::path::filename(path).str());
+		return;
+	}
+	std::error_code EC;
+	std::vector<std::string> found;
+	for (sys::fs::recursive_directory_iterator I(path, EC), E; I != E && !EC; I.increment(EC))
+		if (sys::path::extension(I->path()) == ".k" && sys::fs::is_regular_file(I->path()))
+			found.push_back(I->path());
+	// Directory order is arbitrary; keep outputs and reports reproducible.
+	std::sort(found.begin(), found.end());
+	for (const auto& f : found) {
+		inputs.push_back(f);
+		names.push_back(StringRef(f).drop_front(path.size()).ltrim(sys::path::get_separator()).str());
+	}
+}
+
+struct Job {
+	std::string Input;
+	std::string Output;  // with -split, the first of the partitions
+	std::string Error;
+	std::string Log;     // what -v -v printed while compiling it
+	bool Ok = false;
+	SmallVector<char, 0> Bitcode;
+};
+
+/// ParseCount - Set n from a positive decimal count; false if it isn't one.
+static bool ParseCount(StringRef arg, unsigned& n) {
+	return !arg.getAsInteger(10, n) && n > 0;
+}
+
+/// EmitPartitions - Compile with -split: job.Output names partition 0, and
+/// partition i goes next to it as <name>.<i>.o.
+static bool EmitPartitions(ProgNode& prog, Job& job, const CompileOptions& opts) {
+	std::vector<SmallVector<char, 0>> outs;
+	if (!EmitPartitionsToBuffers(prog, job.Input, opts, job.Error, outs))
+		return false;
+	StringRef ext = opts.EmitBitcode ? ".bc" : ".o";
+	StringRef base = StringRef(job.Output).drop_back(ext.size() + 2);
+	for (size_t i = 0; i != outs.size(); ++i) {
+		std::string out = (base + "." + Twine(i) + ext).str();
+		if (!WriteFile(out, StringRef(outs[i].data(), outs[i].size()), job.Error))
+			return false;
+	}
+	return true;
+}
+
+
+int main(int argc, char** argv) {
+	CompileOptions opts;
+	unsigned threads = std::thread::hardware_concurrency();
+	std::string outdir, linkfile, membudget, profilefile, astcache;
+	bool memreport = false;
+	std::vector<std::string> inputs, names;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool ok = true;
+		if (arg == "-j" && i + 1 < argc)
+			ok = ParseCount(argv[++i], threads);
+		else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0)
+			ok = ParseCount(arg.substr(2), threads);
+		else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && isdigit(arg[2]))
+			opts.OptLevel = std::min(arg[2] - '0', 3);
+		else if (arg == "-emit-llvm")
+			opts.EmitBitcode = true;
+		else if (arg == "-o" && i + 1 < argc)
+			outdir = argv[++i];
+		else if (arg == "-link" && i + 1 < argc)
+			linkfile = argv[++i];
+		else if (arg == "-ast-cache" && i + 1 < argc)
+			astcache = argv[++i];
+		else if (arg == "-split" && i + 1 < argc)
+			ok = ParseCount(argv[++i], opts.Partitions);
+		else if (arg == "-export" && i + 1 < argc)
+			opts.Exports.insert(argv[++i]);
+		else if (arg == "-fprofile-generate")
+			opts.ProfileGenerate = true;
+		else if (arg.compare(0, 14, "-fprofile-use=") == 0)
+			profilefile = arg.substr(14);
+		else if (arg == "-pg")
+			opts.TimeProfile = true;
+		else if (arg == "-fbounds-check")
+			opts.BoundsChecks = CheckMode::On;
+		else if (arg == "-fno-bounds-check")
+			opts.BoundsChecks = CheckMode::Off;
+		else if (arg == "-g")
+			opts.DebugInfo = true;
+		else if (arg == "-mem-report")
+			memreport = true;
+		else if (arg.compare(0, 12, "-mem-budget=") == 0)
+			membudget = arg.substr(12);
+		else if (arg == "-v")
+			++Verbosity;
+		else if (!arg.empty() && arg[0] == '-')
+			ok = false;
+		else
+			CollectInputs(arg, inputs, names);
+		if (!ok) {
+			Usage();
+			return 1;
+		}
+	}
+	if (inputs.empty()) {
+		Usage();
+		return 1;
+	}
+	if (opts.Partitions > 1 && !linkfile.empty()) {
+		errs() << "error: -link and -split can't be combined\n";
+		return 1;
+	}
+	// Read once; every job optimizes with the same counts.
+	ProfileCounts profile;
+	if (!profilefile.empty()) {
+		std::string error;
+		if (!LoadProfile(profilefile, profile, error)) {
+			errs() << "error: " << error << '\n';
+			return 1;
+		}
+		opts.ProfileUse = &profile;
+	}
+
+	std::vector<Job> jobs(inputs.size());
+	// Two inputs writing the same output would race; refuse before any runs.
+	StringMap<size_t> owners;
+	for (size_t i = 0; i != inputs.size(); ++i) {
+		jobs[i].Input = inputs[i];
+		SmallString<256> out(inputs[i]);
+		if (!outdir.empty()) {
+			out = outdir;
+			sys::path::append(out, names[i]);
+		}
+		if (opts.Partitions > 1)
+			sys::path::replace_extension(out, opts.EmitBitcode ? ".0.bc" : ".0.o");
+		else
+			sys::path::replace_extension(out, opts.EmitBitcode ? ".bc" : ".o");
+		jobs[i].Output = std::string(out);
+		auto owner = owners.try_emplace(jobs[i].Output, i);
+		if (!owner.second) {
+			errs() << "error: " << inputs[owner.first->second] << " and " << inputs[i]
+			       << " both compile to " << jobs[i].Output << '\n';
+			return 1;
+		}
+		if (!outdir.empty())
+			sys::fs::create_directories(sys::path::parent_path(jobs[i].Output));
+	}
+	if (!astcache.empty())
+		sys::fs::create_directories(astcache);
+
+	InitializeCompilerTargets();
+	if (memreport || !membudget.empty())
+		EnableMemTracking();
+	{
+		// Partitions of a split input are jobs of this pool too.
+		WorkStealingPool pool(std::min<size_t>(threads, inputs.size() * opts.Partitions));
+		for (size_t i = 0; i != jobs.size(); ++i) {
+			pool.submit([&pool, &jobs, &opts, &linkfile, &astcache, i] {
+				Job& job = jobs[i];
+				// Workers log into the job, printed with its result.
+				BufferLog = true;
+				std::shared_ptr<ProgNode> prog = ParseFile(job.Input, job.Error, opts.DebugInfo, nullptr,
+				                                           astcache);
+				job.Log = TakeLog();
+				if (!prog)
+					return;
+				// Code generation is a separate job: it usually runs right
+				// here next, but an idle worker may steal it.
+				pool.submit([&job, &opts, &linkfile, prog] {
+					BufferLog = true;
+					if (opts.Partitions > 1)
+						job.Ok = EmitPartitions(*prog, job, opts);
+					else
+						job.Ok = EmitProgram(*prog, job.Input, job.Output, opts, job.Error,
+						                     linkfile.empty() ? nullptr : &job.Bitcode);
+					job.Log += TakeLog();
+				});
+			});
+		}
+		pool.wait();
+	}
+
+	unsigned failed = 0;
+	for (const auto& job : jobs) {
+		outs() << job.Log;
+		outs().flush();
+		if (job.Ok) {
+			Log(1) << job.Input << " -> " << job.Output << '\n';
+			continue;
+		}
+		++failed;
+		errs() << job.Input << ": error: " << job.Error << '\n';
+	}
+
+	if (!linkfile.empty()) {
+		LLVMContext Ctx;
+		auto Linked = std::make_unique<Module>(linkfile, Ctx);
+		Linker L(*Linked);
+		for (const auto& job : jobs) {
+			if (!job.Ok)
+				continue;
+			StringRef buf(job.Bitcode.data(), job.Bitcode.size());
+			auto M = parseBitcodeFile(MemoryBufferRef(buf, job.Input), Ctx);
+			if (!M || L.linkInModule(std::move(*M))) {
+				if (!M)
+					consumeError(M.takeError());
+				errs() << job.Input << ": error: cannot link module\n";
+				++failed;
+			}
+		}
+		if (failed) {
+			// A module missing some inputs would pass for the whole program.
+			errs() << linkfile << ": error: not written, " << failed << " input(s) failed\n";
+			sys::fs::remove(linkfile);
+		} else {
+			std::error_code EC;
+			raw_fd_ostream OS(linkfile, EC, sys::fs::OF_None);
+			if (EC) {
+				errs() << linkfile << ": error: " << EC.message() << '\n';
+				return 1;
+			}
+			WriteBitcodeToFile(*Linked, OS);
+		}
+	}
+
+	Log(1) << jobs.size() - failed << " of " << jobs.size() << " files compiled\n";
+	if (memreport)
+		PrintMemReport(errs());
+	std::string error;
+	if (!membudget.empty() && !CheckMemBudget(membudget, error)) {
+		errs() << "error: " << membudget << ":\n" << error << '\n';
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#include "hostfn.h"
+#include "llvm/ADT/StringExtras.h"
+#include <mutex>
+
+
+namespace {
+
+struct HostRegistry {
+  std::mutex Lock;
+  // Never erased from, so entries stay put for FindHostFunction's callers.
+  std::map<std::string, HostFunction> Functions;
+
+  HostRegistry() {
+    auto Intrinsic1 = [&](const char* name, Intrinsic::ID id) {
+      HostFunction F;
+      F.Name = name;
+      F.Sig.Params = {ValType::F64};
+      F.Sig.Ret = ValType::F64;
+      F.Inline = [id](IRBuilder<>& B, ArrayRef<Value*> args) {
+        return B.CreateUnaryIntrinsic(id, args[0]);
+      };
+      Functions[name] = std::move(F);
+    };
+    Intrinsic1("sqrt", Intrinsic::sqrt);
+    Intrinsic1("fabs", Intrinsic::fabs);
+    Intrinsic1("floor", Intrinsic::floor);
+  }
+};
+
+HostRegistry& Registry() {
+  static HostRegistry R;
+  return R;
+}
+
+} // namespace
+
+
+bool RegisterHostFunction(HostFunction fn, std::string& error) {
+  StringRef Name = fn.Name;
+  ValType Ignored;
+  if (Name.empty() || !isAlpha(Name[0]) || !all_of(Name, isAlnum) ||
+      ParseTypeName(fn.Name, Ignored) || Name == "len") {
+    error = "'" + fn.Name + "' can't be called from a program";
+    return false;
+  }
+  for (ValType T : fn.Sig.Params)
+    if (T == ValType::Unknown) {
+      error = fn.Name + ": parameter types must be given";
+      return false;
+    }
+  if (fn.Sig.Ret == ValType::Unknown || IsArray(fn.Sig.Ret)) {
+    error = fn.Name + ": the result must be i32, i64 or f64";
+    return false;
+  }
+
+  HostRegistry& R = Registry();
+  std::lock_guard<std::mutex> G(R.Lock);
+  if (!R.Functions.emplace(fn.Name, fn).second) {
+    error = fn.Name + " is already registered";
+    return false;
+  }
+  return true;
+}
+
+const HostFunction* FindHostFunction(StringRef name) {
+  HostRegistry& R = Registry();
+  std::lock_guard<std::mutex> G(R.Lock);
+  auto It = R.Functions.find(name.str());
+  return It == R.Functions.end() ? nullptr : &It->second;
+}
@@ -0,0 +1,68 @@
+#ifndef Z_HOSTFN_H
+#define Z_HOSTFN_H
+
+#include "types.h"
+#include "llvm/IR/IRBuilder.h"
+#include <functional>
+
+using namespace llvm;
+
+/*
+ * Host functions - native routines programs call like their own functions.
+ *
+ * A host function is registered with its signature before programs using it
+ * are compiled.  A call to a name the program doesn't define is typed
+ * against that signature and compiled to a call of an external declaration
+ * of the same name.  KaleidoscopeJIT binds the declaration to Address (or,
+ * without one, to the symbol of that name in the process); an object file
+ * from Driver leaves it for the native link to resolve.  Parameters use the
+ * ABI of program functions, so an array is (T* data, int64_t len):
+ *
+ *   extern "C" int64_t hash(const int64_t* key, int64_t key_len, int64_t seed);
+ *
+ * is { "hash", {{ArrI64, I64}, I64}, (void*)&hash }.
+ *
+ * A small routine may give Inline instead, which builds its result at every
+ * call site from the arguments (already converted to the parameter types,
+ * arrays as a pointer and a length), so no call is left for the optimizer
+ * to see past.  sqrt, fabs and floor are registered that way from the start.
+ *
+ * A function the program defines hides a host function of the same name.
+ */
+struct HostFunction {
+  std::string Name;
+  FunctionSig Sig;
+  void* Address = nullptr;
+  std::function<Value*(IRBuilder<>&, ArrayRef<Value*>)> Inline;
+};
+
+/// RegisterHostFunction - Add fn.  Returns false and sets error if the name
+/// can't be called (not an identifier, taken by a conversion or builtin, or
+/// already registered) or the signature isn't complete scalars and arrays
+/// with a scalar result.
+bool RegisterHostFunction(HostFunction fn, std::string& error);
+
+/// FindHostFunction - The registered function name, or nullptr.
+const HostFunction* FindHostFunction(StringRef name);
+
+/// HostType - The ValType of a C parameter or result type.
+template <typename T> struct HostType;
+template <> struct HostType<int32_t> { static constexpr ValType value = ValType::I32; };
+template <> struct HostType<int64_t> { static constexpr ValType value = ValType::I64; };
+template <> struct HostType<double> { static constexpr ValType value = ValType::F64; };
+
+/// RegisterHostFunction - Shorthand for a native function taking and
+/// returning int32_t, int64_t and double:
+///
+///   RegisterHostFunction("mix", &mix, error);
+template <typename R, typename... Args>
+bool RegisterHostFunction(StringRef name, R (*fn)(Args...), std::string& error) {
+  HostFunction F;
+  F.Name = name.str();
+  F.Sig.Params = {HostType<Args>::value...};
+  F.Sig.Ret = HostType<R>::value;
+  F.Address = reinterpret_cast<void*>(fn);
+  return RegisterHostFunction(std::move(F), error);
+}
+
+#endif
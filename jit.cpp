@@ -0,0 +1,263 @@
+#include "jit.h"
+#include "hostfn.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/Process.h"
+#include <mutex>
+
+// profile_rt.cpp
+extern "C" void __kprof_register(void*, int32_t);
+extern "C" void __kprof_unregister(void*);
+extern "C" void __kprof_enter(void*, uint64_t);
+extern "C" void __kprof_exit(void*, uint64_t);
+
+
+namespace {
+
+/// PerfMapListener - Append "<start> <size> <name>" for every JITed function
+/// to /tmp/perf-<pid>.map, the format perf reads for anonymous code.
+class PerfMapListener : public JITEventListener {
+  std::mutex Lock;
+  std::unique_ptr<raw_fd_ostream> Out;
+
+public:
+  PerfMapListener() {
+    std::error_code EC;
+    std::string Path = "/tmp/perf-" + std::to_string(sys::Process::getProcessId()) + ".map";
+    Out = std::make_unique<raw_fd_ostream>(Path, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << Path << ": " << EC.message() << '\n';
+      Out.reset();
+    }
+  }
+
+  void notifyObjectLoaded(ObjectKey, const object::ObjectFile& Obj,
+                          const RuntimeDyld::LoadedObjectInfo& L) override {
+    if (!Out)
+      return;
+    // The debug copy has its sections moved to where they were loaded.
+    object::OwningBinary<object::ObjectFile> DebugObj = L.getObjectForDebug(Obj);
+    const object::ObjectFile& O = DebugObj.getBinary() ? *DebugObj.getBinary() : Obj;
+
+    std::lock_guard<std::mutex> G(Lock);
+    for (const auto& P : object::computeSymbolSizes(O)) {
+      const object::SymbolRef& Sym = P.first;
+      Expected<object::SymbolRef::Type> Type = Sym.getType();
+      if (!Type || *Type != object::SymbolRef::ST_Function) {
+        consumeError(Type.takeError());
+        continue;
+      }
+      Expected<StringRef> Name = Sym.getName();
+      Expected<uint64_t> Addr = Sym.getAddress();
+      if (!Name || !Addr || P.second == 0) {
+        consumeError(Name.takeError());
+        consumeError(Addr.takeError());
+        continue;
+      }
+      Out->write_hex(*Addr) << ' ';
+      Out->write_hex(P.second) << ' ' << *Name << '\n';
+    }
+    Out->flush();
+  }
+};
+
+} // namespace
+
+
+KaleidoscopeJIT::~KaleidoscopeJIT() {
+  if (!J)
+    return;
+  for (auto It = Destructors.rbegin(); It != Destructors.rend(); ++It) {
+    std::string Error;
+    if (auto* Dtor = (void (*)())lookup(*It, Error))
+      Dtor();
+  }
+  consumeError(J->deinitialize(J->getMainJITDylib()));
+}
+
+std::unique_ptr<KaleidoscopeJIT> KaleidoscopeJIT::Create(bool perfMap, std::string& error,
+                                                         unsigned compileThreads,
+                                                         bool debugger) {
+  InitializeCompilerTargets();
+
+  std::unique_ptr<KaleidoscopeJIT> KJ(new KaleidoscopeJIT);
+  if (perfMap) {
+    KJ->PerfMap = std::make_unique<PerfMapListener>();
+    KJ->Listeners.push_back(KJ->PerfMap.get());
+    // Null when LLVM was built without perf support.
+    if (JITEventListener* Dump = JITEventListener::createPerfJITEventListener())
+      KJ->Listeners.push_back(Dump);
+  }
+  if (debugger)
+    KJ->Listeners.push_back(JITEventListener::createGDBRegistrationListener());
+
+  auto J = orc::LLJITBuilder()
+    .setNumCompileThreads(compileThreads)
+    .setObjectLinkingLayerCreator([&](orc::ExecutionSession& ES, const Triple&) {
+      auto Layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(ES, [] {
+        return std::make_unique<SectionMemoryManager>();
+      });
+      for (JITEventListener* L : KJ->Listeners)
+        Layer->registerJITEventListener(*L);
+      return Layer;
+    })
+    .create();
+  if (!J) {
+    error = toString(J.takeError());
+    return nullptr;
+  }
+  KJ->J = std::move(*J);
+
+  orc::SymbolMap Runtime;
+  auto Bind = [&](StringRef name, void* addr) {
+    Runtime[KJ->J->mangleAndIntern(name)] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(addr), JITSymbolFlags::Exported);
+  };
+  Bind("__kprof_register", (void*)&__kprof_register);
+  Bind("__kprof_unregister", (void*)&__kprof_unregister);
+  Bind("__kprof_enter", (void*)&__kprof_enter);
+  Bind("__kprof_exit", (void*)&__kprof_exit);
+  if (Error E = KJ->J->getMainJITDylib().define(orc::absoluteSymbols(std::move(Runtime)))) {
+    error = toString(std::move(E));
+    return nullptr;
+  }
+
+  auto Process = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+    KJ->J->getDataLayout().getGlobalPrefix());
+  if (!Process) {
+    error = toString(Process.takeError());
+    return nullptr;
+  }
+  KJ->J->getMainJITDylib().addGenerator(std::move(*Process));
+  return KJ;
+}
+
+bool KaleidoscopeJIT::addModule(std::unique_ptr<Module> M, std::unique_ptr<LLVMContext> Ctx,
+                                std::string& error) {
+  M->setDataLayout(J->getDataLayout());
+
+  // Bind the host functions this module is the first to call.
+  orc::SymbolMap Host;
+  for (const Function& F : *M) {
+    const HostFunction* HF = F.isDeclaration() ? FindHostFunction(F.getName()) : nullptr;
+    if (HF && HF->Address && BoundHostFunctions.insert(HF->Name).second)
+      Host[J->mangleAndIntern(HF->Name)] =
+        JITEvaluatedSymbol(pointerToJITTargetAddress(HF->Address), JITSymbolFlags::Exported);
+  }
+  if (!Host.empty())
+    if (Error E = J->getMainJITDylib().define(orc::absoluteSymbols(std::move(Host)))) {
+      error = toString(std::move(E));
+      return false;
+    }
+
+  if (GlobalVariable* Dtors = M->getNamedGlobal("llvm.global_dtors")) {
+    for (const auto& D : orc::getDestructors(*M)) {
+      if (!D.Func)
+        continue;
+      // A split program may define it in another partition, by this name.
+      if (!D.Func->isDeclaration()) {
+        D.Func->setName("__dtor." + std::to_string(Destructors.size()));
+        D.Func->setLinkage(GlobalValue::ExternalLinkage);
+        D.Func->setVisibility(GlobalValue::HiddenVisibility);
+      }
+      Destructors.push_back(D.Func->getName().str());
+    }
+    Dtors->eraseFromParent();
+  }
+
+  if (Error E = J->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+    error = toString(std::move(E));
+    return false;
+  }
+  return true;
+}
+
+bool KaleidoscopeJIT::addProgram(ProgNode& prog, const std::string& moduleName,
+                                 const CompileOptions& opts, std::string& error) {
+  // The module takes this thread's context with it.
+  CompileOptions Opts = opts;
+  Opts.ReuseContext = false;
+  if (Opts.Partitions > 1) {
+    std::vector<ModulePartition> Parts;
+    if (!GeneratePartitions(prog, moduleName, Opts, Parts, error))
+      return false;
+    for (ModulePartition& P : Parts)
+      if (!addModule(std::move(P.M), std::move(P.Context), error))
+        return false;
+  } else {
+    if (!GenerateModule(prog, moduleName, Opts, error)) {
+      ReleaseModule(false);
+      return false;
+    }
+    Builder.reset();
+    if (!addModule(std::move(TheModule), std::move(TheContext), error))
+      return false;
+  }
+
+  if (Error E = J->initialize(J->getMainJITDylib())) {
+    error = toString(std::move(E));
+    return false;
+  }
+  return true;
+}
+
+void* KaleidoscopeJIT::lookup(StringRef name, std::string& error) {
+  auto Sym = J->lookup(name);
+  if (!Sym) {
+    error = toString(Sym.takeError());
+    return nullptr;
+  }
+  return jitTargetAddressToPointer<void*>(Sym->getAddress());
+}
+
+KaleidoscopeJIT::EntryFn KaleidoscopeJIT::lookupEntry(const FunDefNode& def, std::string& error) {
+  auto Ctx = std::make_unique<LLVMContext>();
+  auto M = std::make_unique<Module>("entry." + def.FunDefName, *Ctx);
+  M->setDataLayout(J->getDataLayout());
+  auto TypeOf = [&](ValType t) -> Type* {
+    return t == ValType::F64 ? Type::getDoubleTy(*Ctx)
+         : t == ValType::I64 ? Type::getInt64Ty(*Ctx) : Type::getInt32Ty(*Ctx);
+  };
+
+  // An array is a pointer and an i64 length.
+  std::vector<Type*> Params;
+  for (unsigned i = 0; i != def.FunDefArgs.size(); ++i) {
+    ValType T = def.getArgType(i);
+    if (IsArray(T)) {
+      Params.push_back(TypeOf(ElementType(T))->getPointerTo());
+      Params.push_back(Type::getInt64Ty(*Ctx));
+    } else {
+      Params.push_back(TypeOf(T));
+    }
+  }
+  FunctionCallee Target = M->getOrInsertFunction(def.FunDefName,
+    FunctionType::get(TypeOf(def.Ty), Params, false));
+
+  // void entry(i64* slots): unpack, call, pack.
+  Type* I64 = Type::getInt64Ty(*Ctx);
+  Function* Entry = Function::Create(
+    FunctionType::get(Type::getVoidTy(*Ctx), {I64->getPointerTo()}, false),
+    Function::ExternalLinkage, "__entry." + def.FunDefName, M.get());
+  IRBuilder<> B(BasicBlock::Create(*Ctx, "entry", Entry));
+  Value* Slots = Entry->getArg(0);
+  std::vector<Value*> Args;
+  for (unsigned i = 0; i != Params.size(); ++i) {
+    Value* Slot = B.CreateLoad(I64, B.CreateConstGEP1_32(I64, Slots, i));
+    Args.push_back(Params[i]->isDoubleTy()  ? B.CreateBitCast(Slot, Params[i])
+                 : Params[i]->isPointerTy() ? B.CreateIntToPtr(Slot, Params[i])
+                                            : B.CreateTrunc(Slot, Params[i]));
+  }
+  Value* Result = B.CreateCall(Target, Args);
+  Result = Result->getType()->isDoubleTy() ? B.CreateBitCast(Result, I64)
+                                           : B.CreateSExt(Result, I64);
+  B.CreateStore(Result, Slots);
+  B.CreateRetVoid();
+
+  if (Error E = J->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx)))) {
+    error = toString(std::move(E));
+    return nullptr;
+  }
+  return (EntryFn)lookup("__entry." + def.FunDefName, error);
+}
@@ -0,0 +1,74 @@
+#ifndef Z_JIT_H
+#define Z_JIT_H
+
+#include "compile.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+
+/*
+ * KaleidoscopeJIT - Compile programs into this process and run them.
+ *
+ * Code is linked in memory by RuntimeDyld, so the usual JIT event listeners
+ * see every object.  With PerfMap set, each function is listed in
+ * /tmp/perf-<pid>.map and a jitdump (jit-<pid>.dump, under $JITDUMPDIR or
+ * ~/.debug/jit) is written, so perf can name samples taken in JITed code.
+ * With Debugger set, every object is registered with GDB's JIT interface
+ * (__jit_debug_register_code), so a debugger attached to the process sees
+ * the JITed functions, and with CompileOptions::DebugInfo their source lines
+ * and variables.
+ *
+ * The profiling runtime (profile_rt.cpp) is bound into every JIT, so
+ * -fprofile-generate and -pg code runs as is.  Host functions (hostfn.h) a
+ * program calls are bound to their Address as it is added; those without
+ * one, and anything else left undefined, resolve to this process's symbols.
+ * Module constructors run as programs are added and destructors when the
+ * JIT is destroyed, in reverse.
+ */
+class KaleidoscopeJIT {
+  // Listeners - PerfMap and LLVM's own, which are never deleted.  Declared
+  // before J, which notifies them until it is gone.
+  std::unique_ptr<JITEventListener> PerfMap;
+  std::vector<JITEventListener*> Listeners;
+  std::unique_ptr<orc::LLJIT> J;
+  std::set<std::string> BoundHostFunctions;
+  /// Destructors - The modules' llvm.global_dtors, renamed to be found
+  /// again; LLJIT only runs constructors.
+  std::vector<std::string> Destructors;
+
+  KaleidoscopeJIT() = default;
+
+  /// addModule - Bind the host functions M calls, take over its
+  /// destructors and hand M to J.
+  bool addModule(std::unique_ptr<Module> M, std::unique_ptr<LLVMContext> Ctx,
+                 std::string& error);
+
+public:
+  ~KaleidoscopeJIT();
+
+  /// Create - Returns nullptr and sets error on failure.  With
+  /// compileThreads, modules are compiled to machine code that many at a
+  /// time; otherwise on the thread that looks their symbols up.
+  static std::unique_ptr<KaleidoscopeJIT> Create(bool perfMap, std::string& error,
+                                                 unsigned compileThreads = 0,
+                                                 bool debugger = false);
+
+  /// addProgram - Generate code for prog with opts and make it callable.
+  /// With opts.Partitions above one it is split (GeneratePartitions) and
+  /// each partition added as a module of its own.  Runs the constructors.
+  bool addProgram(ProgNode& prog, const std::string& moduleName,
+                  const CompileOptions& opts, std::string& error);
+
+  /// lookup - Address of the named function, or nullptr and error.
+  void* lookup(StringRef name, std::string& error);
+
+  /// EntryFn - Calls a function with its arguments in slots, integers as
+  /// such, doubles as their bits and arrays as a pointer slot and a length
+  /// slot, and leaves the result in slots[0].
+  typedef void (*EntryFn)(uint64_t* slots);
+
+  /// lookupEntry - An EntryFn for def, which must have been added (so its
+  /// types are inferred).  Returns nullptr and sets error on failure.
+  EntryFn lookupEntry(const FunDefNode& def, std::string& error);
+};
+
+#endif
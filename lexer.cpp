@@ -2,7 +2,16 @@
 
 
 void Lexer::advance() {
-	currentChar = file.get();
+	if (currentChar == '\n') {
+		line++;
+		col = 1;
+	} else
+		col++;
+	currentChar = in->get();
+}
+
+Token Lexer::makeToken(TokenAttr t, const std::string& n) {
+	return Token(t, n, tokLine, tokCol);
 }
 
 Token Lexer::identifier() {
@@ -12,29 +21,59 @@ Token Lexer::identifier() {
 		advance();
 	}
 	if (result == "def" || result == "let" || result == "if" || 
-	    result == "then" || result == "else")
-		return Token(TokenAttr::Keyword, result);
-	return Token(TokenAttr::Identifier, result);
+	    result == "then" || result == "else" || result == "for" ||
+	    result == "to" || result == "step" || result == "in" ||
+	    result == "while" || result == "do")
+		return makeToken(TokenAttr::Keyword, result);
+	return makeToken(TokenAttr::Identifier, result);
 }
 
 Token Lexer::number() {
+	// digits [. digits] [e [+-] digits]; the parser tells ints from doubles.
 	std::string result;
 	while (std::isdigit(currentChar)) {
 		result += currentChar;
 		advance();
 	}
-	return Token(TokenAttr::Number, result);
+	if (currentChar == '.') {
+		result += currentChar;
+		advance();
+		while (std::isdigit(currentChar)) {
+			result += currentChar;
+			advance();
+		}
+	}
+	if (currentChar == 'e' || currentChar == 'E') {
+		result += currentChar;
+		advance();
+		if (currentChar == '+' || currentChar == '-') {
+			result += currentChar;
+			advance();
+		}
+		while (std::isdigit(currentChar)) {
+			result += currentChar;
+			advance();
+		}
+	}
+	return makeToken(TokenAttr::Number, result);
 }
 
 bool Lexer::isOperator(char c) {
-	return c == '+' || c == '-' || c == '*' || c == '/' || c == '=';
+	return c == '+' || c == '-' || c == '*' || c == '/' || c == '=' ||
+	       c == '<' || c == '>' || c == ':';
 }
 
 bool Lexer::isParenthesis(char c) {
-	return c == '(' || c == ')' || c == '{' || c == '}';
+	return c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']';
 }
 
-Lexer::Lexer(const std::string& filename) {
+Lexer::Lexer(const std::string& filename, const std::string* source) {
+	if (source) {
+		text.str(*source);
+		in = &text;
+		advance();
+		return;
+	}
 	file.open(filename);
 	if (!file.is_open()) {
 		std::cerr << "Error opening file" << std::endl;
@@ -53,6 +92,8 @@ Token Lexer::getToken() {
 	while (std::isspace(currentChar)) {
        	advance();
        }
+	tokLine = line;
+	tokCol = col;
 
 	if (std::isalpha(currentChar)) {
 		return identifier();
@@ -65,26 +106,26 @@ Token Lexer::getToken() {
 	if (isOperator(currentChar)) {
 		char op = currentChar;
 		advance();
-		return Token(TokenAttr::Operator, std::string(1, op));
+		return makeToken(TokenAttr::Operator, std::string(1, op));
 	}
 
 	if (isParenthesis(currentChar)) {
 		char par = currentChar;
 		advance();
-		return Token(TokenAttr::Parenthesis, std::string(1, par));
+		return makeToken(TokenAttr::Parenthesis, std::string(1, par));
 	}
         
 	if (currentChar == '='){
 		advance();
-		return Token(TokenAttr::Assignment, "=");
+		return makeToken(TokenAttr::Assignment, "=");
 	}
 	if (currentChar == EOF) {
-		return Token(TokenAttr::EndOfFile, "");
+		return makeToken(TokenAttr::EndOfFile, "");
 	}
 
 	char unknownChar = currentChar;
 	advance();
-	return Token(TokenAttr::Unknown, std::string(1, unknownChar));
+	return makeToken(TokenAttr::Unknown, std::string(1, unknownChar));
 }
 
 std::vector<Token> Lexer::getTokenVec()
@@ -4,22 +4,30 @@
 #include "token.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cctype>
 #include <vector>
 
 class Lexer {
 private:
     std::ifstream file;
-    char currentChar;
+    std::istringstream text;
+    std::istream* in = &file;   // file, or text when given the source
+    char currentChar = 0;
+    int line = 1, col = 0;        // position of currentChar
+    int tokLine = 1, tokCol = 1;  // position of the token being lexed
 
     void advance();
+    Token makeToken(TokenAttr t, const std::string& n);
     Token identifier();
     Token number();
     bool isOperator(char c);
     bool isParenthesis(char c);
 public:
     
-    Lexer(const std::string& filename);
+    /// Lexer - Lex filename, or source if given: filename's text, already
+    /// read.
+    Lexer(const std::string& filename, const std::string* source = nullptr);
 
     ~Lexer();
 
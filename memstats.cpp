@@ -0,0 +1,232 @@
+#include "memstats.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <atomic>
+#include <malloc.h>
+#include <new>
+
+
+namespace {
+
+struct PhaseCounters {
+  std::atomic<uint64_t> Allocs{0};
+  std::atomic<uint64_t> Bytes{0};
+  std::atomic<uint64_t> Peak{0};
+};
+
+std::atomic<bool> Enabled{false};
+PhaseCounters Counters[size_t(MemPhase::NumPhases)];
+std::atomic<int64_t> Live{0};
+std::atomic<int64_t> PeakLive{0};
+std::atomic<uint64_t> SourceBytes{0};
+
+thread_local MemPhase CurPhase = MemPhase::Other;
+// ThreadLive - What this thread allocated less what it freed; PhaseBase is
+// its value when the current phase began.
+thread_local int64_t ThreadLive = 0;
+thread_local int64_t PhaseBase = 0;
+
+template <typename T>
+void AtomicMax(std::atomic<T>& a, T v) {
+  T Old = a.load(std::memory_order_relaxed);
+  while (Old < v && !a.compare_exchange_weak(Old, v, std::memory_order_relaxed))
+    ;
+}
+
+void CountAlloc(void* p) {
+  if (!p || !Enabled.load(std::memory_order_relaxed))
+    return;
+  int64_t Size = malloc_usable_size(p);
+  PhaseCounters& C = Counters[size_t(CurPhase)];
+  C.Allocs.fetch_add(1, std::memory_order_relaxed);
+  C.Bytes.fetch_add(Size, std::memory_order_relaxed);
+  ThreadLive += Size;
+  if (ThreadLive > PhaseBase)
+    AtomicMax(C.Peak, uint64_t(ThreadLive - PhaseBase));
+  AtomicMax(PeakLive, Live.fetch_add(Size, std::memory_order_relaxed) + Size);
+}
+
+void CountFree(void* p) {
+  if (!p || !Enabled.load(std::memory_order_relaxed))
+    return;
+  int64_t Size = malloc_usable_size(p);
+  ThreadLive -= Size;
+  Live.fetch_sub(Size, std::memory_order_relaxed);
+}
+
+void* Allocate(size_t size) {
+  if (size == 0)
+    size = 1;
+  void* P;
+  while (!(P = malloc(size))) {
+    std::new_handler Handler = std::get_new_handler();
+    if (!Handler)
+      throw std::bad_alloc();
+    Handler();
+  }
+  CountAlloc(P);
+  return P;
+}
+
+void Free(void* p) {
+  CountFree(p);
+  free(p);
+}
+
+} // namespace
+
+
+// Aligned new and delete keep the library's versions, which neither count
+// nor come through here.
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, size_t) noexcept { Free(p); }
+void operator delete[](void* p, size_t) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+
+
+const char* MemPhaseName(MemPhase phase) {
+  switch (phase) {
+  case MemPhase::Lex: return "lex";
+  case MemPhase::Parse: return "parse";
+  case MemPhase::Codegen: return "codegen";
+  case MemPhase::Optimize: return "optimize";
+  case MemPhase::Emit: return "emit";
+  default: return "other";
+  }
+}
+
+void EnableMemTracking() {
+  Enabled.store(true);
+}
+
+bool MemTrackingEnabled() {
+  return Enabled.load(std::memory_order_relaxed);
+}
+
+MemPhaseScope::MemPhaseScope(MemPhase phase) : Saved(CurPhase), SavedBase(PhaseBase) {
+  CurPhase = phase;
+  PhaseBase = ThreadLive;
+}
+
+MemPhaseScope::~MemPhaseScope() {
+  CurPhase = Saved;
+  PhaseBase = SavedBase;
+}
+
+void AddSourceBytes(uint64_t size) {
+  SourceBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+uint64_t GetSourceBytes() {
+  return SourceBytes.load();
+}
+
+MemPhaseStats GetMemPhaseStats(MemPhase phase) {
+  MemPhaseStats S;
+  const PhaseCounters& C = Counters[size_t(phase)];
+  S.Allocs = C.Allocs.load();
+  S.Bytes = C.Bytes.load();
+  S.Peak = C.Peak.load();
+  return S;
+}
+
+uint64_t GetPeakLiveBytes() {
+  return std::max<int64_t>(PeakLive.load(), 0);
+}
+
+/// GetStats - A phase by name, "total" for all of them; false if unknown.
+static bool GetStats(StringRef name, MemPhaseStats& stats) {
+  stats = MemPhaseStats();
+  for (unsigned i = 0; i != unsigned(MemPhase::NumPhases); ++i) {
+    MemPhaseStats S = GetMemPhaseStats(MemPhase(i));
+    if (name == "total") {
+      stats.Allocs += S.Allocs;
+      stats.Bytes += S.Bytes;
+    } else if (name == MemPhaseName(MemPhase(i))) {
+      stats = S;
+      return true;
+    }
+  }
+  stats.Peak = GetPeakLiveBytes();
+  return name == "total";
+}
+
+static double PerSourceByte(uint64_t bytes) {
+  uint64_t Source = GetSourceBytes();
+  return Source ? double(bytes) / Source : 0;
+}
+
+void PrintMemReport(raw_ostream& OS) {
+  OS << "Memory by phase (" << GetSourceBytes() << " source bytes):\n"
+     << "  phase          allocs            bytes        peak  bytes/src\n";
+  auto Row = [&](StringRef name, const MemPhaseStats& S) {
+    OS << "  " << left_justify(name, 9) << format("%11llu %16llu %11llu %10.1f\n",
+      (unsigned long long)S.Allocs, (unsigned long long)S.Bytes,
+      (unsigned long long)S.Peak, PerSourceByte(S.Bytes));
+  };
+  for (unsigned i = 1; i != unsigned(MemPhase::NumPhases); ++i)
+    Row(MemPhaseName(MemPhase(i)), GetMemPhaseStats(MemPhase(i)));
+  Row(MemPhaseName(MemPhase::Other), GetMemPhaseStats(MemPhase::Other));
+  MemPhaseStats Total;
+  GetStats("total", Total);
+  Row("total", Total);
+}
+
+bool CheckMemBudget(const std::string& filename, std::string& error) {
+  auto Buf = MemoryBuffer::getFile(filename);
+  if (!Buf) {
+    error = filename + ": " + Buf.getError().message();
+    return false;
+  }
+
+  error.clear();
+  SmallVector<StringRef, 16> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n');
+  for (unsigned i = 0; i != Lines.size(); ++i) {
+    StringRef Line = Lines[i].split('#').first.trim();
+    if (Line.empty())
+      continue;
+    std::pair<StringRef, StringRef> KV = getToken(Line);
+    StringRef Name = KV.first;
+    bool Peak = Name.consume_back(".peak");
+    MemPhaseStats S;
+    double Limit;
+    if (!GetStats(Name, S) || KV.second.trim().getAsDouble(Limit)) {
+      error += filename + ":" + std::to_string(i + 1) + ": expected '<phase>[.peak] <limit>'\n";
+      continue;
+    }
+    double Used = Peak ? double(S.Peak) : PerSourceByte(S.Bytes);
+    if (Used > Limit)
+      error += KV.first.str() + " is " +
+               (Peak ? std::to_string(S.Peak) + " bytes"
+                     : formatv("{0:f1} bytes per source byte", Used).str()) +
+               ", over the budget of " + KV.second.trim().str() + "\n";
+  }
+  if (!error.empty() && error.back() == '\n')
+    error.pop_back();
+  return error.empty();
+}
@@ -0,0 +1,81 @@
+#ifndef Z_MEMSTATS_H
+#define Z_MEMSTATS_H
+
+#include <cstdint>
+#include <string>
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/*
+ * Memory use by compiler phase.
+ *
+ * memstats.cpp replaces the global operator new and delete.  Once tracking
+ * is enabled every allocation is charged to the phase its thread is in,
+ * set with a MemPhaseScope around each step of ParseFile, GenerateModule
+ * and EmitProgramToBuffer.  A phase reports
+ *
+ *   allocs     operator new calls,
+ *   bytes      bytes they allocated (as malloc rounded them),
+ *   peak       the most this thread's live bytes grew inside one run of
+ *              the phase, i.e. what one compile job needs at once,
+ *
+ * and bytes per byte of source, which stays comparable across inputs.
+ * Allocations outside every scope are "other"; its peak is simply the most
+ * one thread held.
+ * Memory LLVM takes straight from malloc (the bump allocators behind
+ * constants, types and metadata) is not seen, so the IR phases are lower
+ * bounds.  With tracking off, the cost is one relaxed load per allocation.
+ */
+
+enum class MemPhase : uint8_t { Other, Lex, Parse, Codegen, Optimize, Emit, NumPhases };
+
+const char* MemPhaseName(MemPhase phase);
+
+struct MemPhaseStats {
+  uint64_t Allocs = 0;
+  uint64_t Bytes = 0;
+  uint64_t Peak = 0;
+};
+
+/// EnableMemTracking - Start counting.  Allocations made before are not
+/// seen; freeing them later makes the live counts read low.
+void EnableMemTracking();
+bool MemTrackingEnabled();
+
+/// MemPhaseScope - Charge this thread's allocations to phase until the
+/// scope ends.  Scopes nest.
+class MemPhaseScope {
+  MemPhase Saved;
+  int64_t SavedBase;
+
+public:
+  explicit MemPhaseScope(MemPhase phase);
+  ~MemPhaseScope();
+  MemPhaseScope(const MemPhaseScope&) = delete;
+  MemPhaseScope& operator=(const MemPhaseScope&) = delete;
+};
+
+/// AddSourceBytes - Count size bytes of compiled source.
+void AddSourceBytes(uint64_t size);
+uint64_t GetSourceBytes();
+
+MemPhaseStats GetMemPhaseStats(MemPhase phase);
+
+/// GetPeakLiveBytes - The most bytes live at once in the whole process.
+uint64_t GetPeakLiveBytes();
+
+/// PrintMemReport - The table of phases.
+void PrintMemReport(raw_ostream& OS);
+
+/// CheckMemBudget - Compare the phases against the budget in filename, one
+///
+///   <phase> <bytes per source byte>      e.g.  parse 250
+///   <phase>.peak <bytes>                 e.g.  codegen.peak 4000000
+///
+/// per line.  '#' starts a comment; "total" is every phase together and
+/// total.peak the most live in the process at once.
+/// Returns false and describes every overrun in error, or a bad file.
+bool CheckMemBudget(const std::string& filename, std::string& error);
+
+#endif
@@ -1,15 +1,26 @@
 #include "parser.h"
+#include "debuginfo.h"
+#include "llvm/Support/SaveAndRestore.h"
 
 
 void Parser::getNextToken(){
-  index++;
+  LastLine = CurTok.Line;
+  LastEndCol = CurTok.Col + (int)CurTok.name.size();
+  // The last token is always EndOfFile; stay on it instead of running off.
+  if (index + 1 < (int)TokVec.size())
+    index++;
   CurTok = TokVec[index];
 }
 
-Parser::Parser(const std::string& filename) 
-	: index(-1), filename(filename), CurTok(Token(TokenAttr::Unknown," ")), Root(InitAst()), lexer {Lexer(filename)}, TokVec{lexer.getTokenVec()}
+Parser::Parser(const std::string& filename, bool locations, const std::string* source) 
+	: index(-1), filename(filename), CurTok(Token(TokenAttr::Unknown," ")), Root(InitAst()), lexer(filename, source), TokVec{lexer.getTokenVec()}
 {
+	TokVec.push_back(lexer.getToken());
 	getNextToken();
+	if (locations) {
+		Root->Locations = std::make_shared<SourceMap>(filename);
+		Locs = Root->Locations.get();
+	}
 }
 
 Parser::~Parser(){};
@@ -20,60 +31,202 @@ std::unique_ptr<ProgNode> Parser::getRoot(){
 }
 
 
+void Parser::mark(const Node* node, int line, int col){
+  Locs->add(node, {line, col, LastLine, LastEndCol});
+}
+
+
 std::unique_ptr<Node> Parser::ParseError(const std::string& message){
-  std::cout<<"Error: "<< message << '\n';
+  // The first error of a definition is the useful one; the rest are the
+  // callers giving up in turn.
+  if (!Panicking) {
+    int len = std::max<int>(CurTok.name.size(), 1);
+    Diags.push_back({CurTok.Line, CurTok.Col, CurTok.Col + len, message});
+    Panicking = true;
+  }
   return nullptr;
 }
 
+void Parser::PrintDiagnostics(raw_ostream& OS) const {
+  for (const auto& D : Diags)
+    OS << filename << ':' << D.Line << ':' << D.Col << '-' << D.EndCol
+       << ": error: " << D.Message << '\n';
+}
+
+/// synchronize - Skip to a point where parsing can resume after an error:
+/// the next 'def', or just past the next ';'.  Every token is skipped at most
+/// once, so recovery keeps the whole parse linear.
+void Parser::synchronize(){
+  while (CurTok.Attr != TokenAttr::EndOfFile && CurTok.name != "$" && CurTok.name != "def") {
+    if (CurTok.name == ";") {
+      getNextToken();
+      break;
+    }
+    getNextToken();
+  }
+  Panicking = false;
+}
+
 std::unique_ptr<Node> Parser::ParseNumExp(){
-  if (CurTok.Attr == TokenAttr::Number){
-    std::string numstr = CurTok.name;
-    //getNextToken();
-    return std::make_unique<NumNode> (std::stoi(numstr));
-  }  
-  return ParseError("Excepted a number!");
+  if (CurTok.Attr != TokenAttr::Number)
+    return ParseError("Excepted a number!");
+  
+  StringRef numstr = CurTok.name;
+  if (numstr.find_first_of(".eE") != StringRef::npos) {
+    double fp;
+    if (numstr.getAsDouble(fp))
+      return ParseError("Malformed number!");
+    getNextToken();
+    return std::make_unique<NumNode> (fp);
+  }
+  int64_t num;
+  if (numstr.getAsInteger(10, num))
+    return ParseError("Integer literal does not fit in i64!");
+  getNextToken();
+  return std::make_unique<NumNode> (num);
+}
+
+/// ParseTypeAnnotation - [':' type], where type may be '[' type ']' if
+/// allowarray; leaves ty alone if there is none.
+bool Parser::ParseTypeAnnotation(ValType& ty, bool allowarray){
+  if (CurTok.name != ":")
+    return true;
+  getNextToken(); // eat :
+  bool array = CurTok.name == "[";
+  if (array && !allowarray) {
+    ParseError("Only parameters can be arrays!");
+    return false;
+  }
+  if (array)
+    getNextToken(); // eat [
+  if (CurTok.Attr != TokenAttr::Identifier || !ParseTypeName(CurTok.name, ty)) {
+    ParseError("Excepted a type (i32, i64 or f64) after ':'!");
+    return false;
+  }
+  getNextToken();
+  if (array) {
+    if (CurTok.name != "]") {
+      ParseError("Excepted ']' after the element type!");
+      return false;
+    }
+    getNextToken(); // eat ]
+    ty = ArrayOf(ty);
+  }
+  return true;
 }
 
 std::unique_ptr<Node> Parser::ParseVarExp(){
   if (CurTok.Attr == TokenAttr::Identifier){
     std::string vn = CurTok.name;
-    //getNextToken();
-    return std::make_unique<VarNode> (vn);
+    int line = CurTok.Line, col = CurTok.Col;
+    getNextToken();
+    auto var = std::make_unique<VarNode> (vn);
+    if (Locs)
+      mark(var.get(), line, col);
+    return var;
   }  
   return ParseError("Excepted a variable!");
 }
 
-std::unique_ptr<Node> Parser::ParseBinExp() {
-  std::unique_ptr<Node> lhs;
-  
-  if (CurTok.Attr == TokenAttr::Number)
-    lhs = ParseNumExp();
-  else if (CurTok.Attr == TokenAttr::Identifier)
-    lhs = ParseVarExp();
-  else 
-    return ParseError("Excepted an expression in BinExp's LHS!");
-  
-  getNextToken();
-  
-  char Op;
-  if (CurTok.Attr == TokenAttr::Operator)
-    Op = CurTok.name[0];
-  else 
-    return ParseError("Excepted an operator!");
-  
-  getNextToken();
+/// GetTokPrecedence - Binding power of the binary operator in CurTok, or -1
+/// if CurTok does not continue an expression.
+int Parser::GetTokPrecedence(){
+  if (CurTok.Attr != TokenAttr::Operator)
+    return -1;
+  switch (CurTok.name[0]) {
+  case '=': return 2;
+  case '<':
+  case '>': return 10;
+  case '+':
+  case '-': return 20;
+  case '*':
+  case '/': return 40;
+  default: return -1;
+  }
+}
+
+std::unique_ptr<Node> Parser::ParseParenExp() {
+  getNextToken(); // eat (
+  auto exp = ParseExp();
+  if (!exp)
+    return nullptr;
+  
+  if (CurTok.name != ")")
+    return ParseError("Excepted a right Parenthesis!");
+  getNextToken(); // eat )
+  return exp;
+}
+
+std::unique_ptr<Node> Parser::ParsePrimary() {
+  if (Depth >= MaxNestingDepth)
+    return ParseError("Expression nested too deeply!");
+  SaveAndRestore<unsigned> Nest(Depth, Depth + 1);
+
+  // A parenthesized expression is marked where it is parsed.
+  if (CurTok.name == "(")
+    return ParseParenExp();
   
-  std::unique_ptr<Node> rhs;
-  if (CurTok.Attr == TokenAttr::Number)
-    rhs = ParseNumExp();
+  int line = CurTok.Line, col = CurTok.Col;
+  std::unique_ptr<Node> exp;
+  if (CurTok.name == "let")
+    exp = ParseLetExp();
+  else if (CurTok.name == "if")
+    exp = ParseIfExp();
+  else if (CurTok.name == "for")
+    exp = ParseForExp();
+  else if (CurTok.name == "while")
+    exp = ParseWhileExp();
+  else if (CurTok.name == "{")
+    exp = ParseBlockExp();
+  else if (CurTok.Attr == TokenAttr::Number)
+    exp = ParseNumExp();
   else if (CurTok.Attr == TokenAttr::Identifier)
-    rhs = ParseVarExp();
-  else 
-    return ParseError("Excepted an expression in BinExp's RHS!");
-  
-  //getNextToken();
-  
-  return std::make_unique<BinExpNode> (Op, std::move(lhs), std::move(rhs));
+    exp = ParseCalleeExp();
+  else
+    return ParseError("Parse expression failed!");
+  if (Locs && exp)
+    mark(exp.get(), line, col);
+  return exp;
+}
+
+/// ParseBinOpRHS - Precedence climbing: fold (op primary)* into lhs for as
+/// long as the operators bind at least as tightly as minprec.  Every token is
+/// looked at once, so nesting depth does not change the linear cost.
+std::unique_ptr<Node> Parser::ParseBinOpRHS(int minprec, std::unique_ptr<Node> lhs) {
+  while (true) {
+    int prec = GetTokPrecedence();
+    if (prec < minprec)
+      return lhs;
+    
+    char Op = CurTok.name[0];
+    if (Op == '=' && !dynamic_cast<VarNode*>(lhs.get()) &&
+        !dynamic_cast<IndexExpNode*>(lhs.get()))
+      return ParseError("Only a variable or an array element can be assigned!");
+    getNextToken(); // eat the operator
+    
+    auto rhs = ParsePrimary();
+    if (!rhs)
+      return ParseError("Excepted an expression in BinExp's RHS!");
+    
+    // A tighter operator after rhs takes rhs as its own lhs.  '=' is right
+    // associative, so an equal one does too.
+    int nextprec = GetTokPrecedence();
+    if (prec < nextprec || (Op == '=' && nextprec == prec)) {
+      // Only this recursion nests; a left fold is another trip round the
+      // loop, however long the chain.
+      if (Depth >= MaxNestingDepth)
+        return ParseError("Expression nested too deeply!");
+      SaveAndRestore<unsigned> Nest(Depth, Depth + 1);
+      rhs = ParseBinOpRHS(Op == '=' ? prec : prec + 1, std::move(rhs));
+      if (!rhs)
+        return nullptr;
+    }
+    
+    const SourceRange* begin = Locs ? Locs->lookup(lhs.get()) : nullptr;
+    lhs = std::make_unique<BinExpNode> (Op, std::move(lhs), std::move(rhs));
+    if (begin)
+      mark(lhs.get(), begin->Line, begin->Col);
+  }
 }
 
 std::unique_ptr<Node> Parser::ParseCalleeExp() {
@@ -85,30 +238,37 @@ std::unique_ptr<Node> Parser::ParseCalleeExp() {
   
   getNextToken();
   
-  if (CurTok.Attr == TokenAttr::Parenthesis && CurTok.name == "(")
-    getNextToken();
-  else 
-    return ParseError("Excepted a left Parenthesis in Callee!");
+  // name[index] is an array element.
+  if (CurTok.name == "[") {
+    getNextToken(); // eat [
+    auto index = ParseExp();
+    if (!index)
+      return nullptr;
+    if (CurTok.name != "]")
+      return ParseError("Excepted ']' after the index!");
+    getNextToken(); // eat ]
+    return std::make_unique<IndexExpNode> (Callee, std::move(index));
+  }
+  
+  // A name without an argument list is a variable.
+  if (CurTok.name != "(")
+    return std::make_unique<VarNode> (Callee);
+  getNextToken();
   
   std::vector<std::unique_ptr<Node>> Args;
   
-  while (CurTok.Attr == TokenAttr::Number || CurTok.Attr == TokenAttr::Identifier) {
-    if (CurTok.Attr == TokenAttr::Number) {
-      auto arg = ParseNumExp();
-      Args.push_back(std::move(arg));
-      getNextToken();
-    } else if (CurTok.Attr == TokenAttr::Identifier) {
-      auto arg = ParseVarExp();
-      Args.push_back(std::move(arg));
-      getNextToken();
-    }
+  // Arguments are whitespace separated expressions.
+  while (CurTok.name != ")") {
+    if (CurTok.Attr == TokenAttr::EndOfFile || CurTok.name == "$" || CurTok.name == ";")
+      return ParseError("Excepted a right Parenthesis in Callee!");
+    auto arg = ParseExp();
+    if (!arg)
+      return nullptr;
+    Args.push_back(std::move(arg));
   }
+  getNextToken(); // eat )
   
-  if (CurTok.Attr == TokenAttr::Parenthesis && CurTok.name == ")") {
-    //getNextToken();
-    return std::make_unique<CalleeExpNode> (Callee, std::move(Args));
-  } else 
-    return ParseError("Excepted a right Parenthesis in Callee!");
+  return std::make_unique<CalleeExpNode> (Callee, std::move(Args));
 }
 
 
@@ -119,19 +279,22 @@ std::unique_ptr<Node> Parser::ParseLetExp(){
   
   std::unique_ptr<Node> letvar;
   
-  if (CurTok.Attr == TokenAttr::Identifier){
+  if (CurTok.Attr == TokenAttr::Identifier)
     letvar = ParseVarExp();
-    getNextToken();
-  }
   else return ParseError("Excepted a variable!");
   
+  ValType varty = ValType::Unknown;
+  if (!ParseTypeAnnotation(varty))
+    return nullptr;
+  
   if (CurTok.name == "=")
     getNextToken();
   else return ParseError("Excepted assignment '=' ");
   
   auto letbody = ParseExp();
+  if (!letbody) return nullptr;
   
-  return std::make_unique<LetExpNode> (std::move(letvar),std::move(letbody));
+  return std::make_unique<LetExpNode> (std::move(letvar),std::move(letbody),varty);
     
 }
 
@@ -143,13 +306,11 @@ std::unique_ptr<Node> Parser::ParseIfExp(){
   auto cond = ParseExp();
   if (!cond) return ParseError("Excepted an expression in Condition");
   
-  getNextToken();
   if (CurTok.name == "then")
     getNextToken();
   auto then = ParseExp();
   if (!then) return ParseError("Excepted an expression in then branch");
   
-  getNextToken();
   if (CurTok.name == "else")
     getNextToken();
   auto els = ParseExp();
@@ -160,54 +321,110 @@ std::unique_ptr<Node> Parser::ParseIfExp(){
 }
 
 
-std::unique_ptr<Node> Parser::ParseExp(){
-  if (CurTok.name == "let"){
-    return ParseLetExp();
-  }
+std::unique_ptr<Node> Parser::ParseForExp(){
+  getNextToken(); // eat for
   
-  if (CurTok.name == "if"){
-    return ParseIfExp();
-  }
+  if (CurTok.Attr != TokenAttr::Identifier)
+    return ParseError("Excepted an identifier after for!");
+  std::string varname = CurTok.name;
+  getNextToken();
   
-  if (CurTok.Attr == TokenAttr::Number || CurTok.Attr == TokenAttr::Identifier)
-    getNextToken();
+  if (CurTok.name != "=")
+    return ParseError("Excepted '=' after for!");
+  getNextToken();
   
-  if (CurTok.Attr == TokenAttr::Operator) {
-    index--;
-    CurTok = TokVec[index];
-    return ParseBinExp();
-  }
+  auto start = ParseExp();
+  if (!start) return nullptr;
   
-  if (CurTok.Attr == TokenAttr::Parenthesis) {
-    index--;
-    CurTok = TokVec[index];
-    return ParseCalleeExp();
+  if (CurTok.name != "to")
+    return ParseError("Excepted to after for start value!");
+  getNextToken();
+  
+  auto end = ParseExp();
+  if (!end) return nullptr;
+  
+  std::unique_ptr<Node> step;
+  if (CurTok.name == "step") {
+    getNextToken();
+    step = ParseExp();
+    if (!step) return nullptr;
   }
   
-  else {
-    index--;
-    CurTok = TokVec[index];
-    if (CurTok.Attr == TokenAttr::Number)
-      return ParseNumExp();
-    else if (CurTok.Attr == TokenAttr::Identifier)
-      return ParseVarExp();
+  if (CurTok.name != "in")
+    return ParseError("Excepted in after for!");
+  getNextToken();
+  
+  auto body = ParseExp();
+  if (!body) return nullptr;
+  
+  return std::make_unique<ForExpNode> (varname,std::move(start),std::move(end),std::move(step),std::move(body));
+}
+
+std::unique_ptr<Node> Parser::ParseWhileExp(){
+  getNextToken(); // eat while
+  
+  auto cond = ParseExp();
+  if (!cond) return nullptr;
+  
+  if (CurTok.name != "do")
+    return ParseError("Excepted do after while condition!");
+  getNextToken();
+  
+  auto body = ParseExp();
+  if (!body) return nullptr;
+  
+  return std::make_unique<WhileExpNode> (std::move(cond),std::move(body));
+}
+
+/// ParseBlockExp - '{' exp* '}', a statement list usable as an expression.
+std::unique_ptr<Node> Parser::ParseBlockExp(){
+  getNextToken(); // eat {
+  
+  std::vector<std::unique_ptr<Node>> stmtlist;
+  while (CurTok.name != "}"){
+    if (CurTok.Attr == TokenAttr::EndOfFile || CurTok.name == "$" || CurTok.name == ";")
+      return ParseError("Excepted '}' at the end of the block!");
+    auto stmt = ParseExp();
+    if (!stmt)
+      return nullptr;
+    stmtlist.push_back(std::move(stmt));
   }
-  return ParseError("Parse expression failed!");
+  getNextToken(); // eat }
+  
+  if (stmtlist.empty())
+    return ParseError("Excepted an expression in the block!");
+  return std::make_unique<StmtListNode> (std::move(stmtlist));
+}
+
+
+std::unique_ptr<Node> Parser::ParseExp(){
+  auto lhs = ParsePrimary();
+  if (!lhs)
+    return nullptr;
+  return ParseBinOpRHS(0, std::move(lhs));
 }
 
 std::unique_ptr<Node> Parser::ParseStmtList(){
+  int line = CurTok.Line, col = CurTok.Col;
   std::unique_ptr<Node> stmt;
   std::vector<std::unique_ptr<Node>> stmtlist;
   while (CurTok.name != ";"){
+    if (CurTok.Attr == TokenAttr::EndOfFile || CurTok.name == "$")
+      return ParseError("Excepted ';' at the end of the function body!");
     stmt = ParseExp();
+    if (!stmt)
+      return nullptr;
     stmtlist.push_back(std::move(stmt));
-    getNextToken();
   }
   getNextToken();
-  return std::make_unique<StmtListNode> (std::move(stmtlist));
+  auto body = std::make_unique<StmtListNode> (std::move(stmtlist));
+  if (Locs)
+    mark(body.get(), line, col);
+  return body;
 }
 
 std::unique_ptr<Node> Parser::ParseFunDef(){
+  int line = CurTok.Line, col = CurTok.Col;
   if (CurTok.name == "def")
     getNextToken(); 
   else return ParseError("Excepted def!");
@@ -215,6 +432,11 @@ std::unique_ptr<Node> Parser::ParseFunDef(){
   std::string fname;
   
   
+  ValType conv;
+  if (CurTok.Attr == TokenAttr::Identifier && ParseTypeName(CurTok.name, conv))
+    return ParseError("A type name can't be a function name!");
+  if (CurTok.name == "len")
+    return ParseError("len is a builtin and can't be redefined!");
   if (CurTok.Attr == TokenAttr::Identifier){
     fname = CurTok.name;
     getNextToken();
@@ -226,45 +448,65 @@ std::unique_ptr<Node> Parser::ParseFunDef(){
   else return ParseError("Excepted a left Parenthesis in Fun!");
   
   std::vector<std::string> Args;
+  std::vector<ValType> ArgTypes;
+  bool annotated = false;
   
   while (CurTok.Attr == TokenAttr::Identifier) {
     auto arg = CurTok.name;
     Args.push_back(arg);
     getNextToken();
+    ArgTypes.push_back(ValType::Unknown);
+    if (!ParseTypeAnnotation(ArgTypes.back(), true))
+      return nullptr;
+    annotated |= ArgTypes.back() != ValType::Unknown;
   }
+  if (!annotated)
+    ArgTypes.clear();
   
   if (CurTok.Attr == TokenAttr::Parenthesis && CurTok.name == ")")
     getNextToken();
   else return ParseError("Excepted a right Parenthesis in Fun!");
   
-  if (auto body = ParseStmtList())
-    return std::make_unique<FunDefNode> (fname,std::move(Args),std::move(body));
+  ValType retty = ValType::Unknown;
+  if (!ParseTypeAnnotation(retty))
+    return nullptr;
+  
+  if (auto body = ParseStmtList()) {
+    auto def = std::make_unique<FunDefNode> (fname,std::move(Args),std::move(body),
+                                             std::move(ArgTypes),retty);
+    if (Locs)
+      mark(def.get(), line, col);
+    return def;
+  }
   else return ParseError("The body of function: "+ fname + " can't be parsed!");
 }
 
-void Parser::ParseProgram(){
+bool Parser::ParseProgram(){
   std::unique_ptr<Node> funnode;
-  while (CurTok.name != "$"){
-    if (CurTok.name == "def") {
-      if (funnode = ParseFunDef()) {
-        std::cout<<"parse fun ok"<<'\n';
-        addNode(Root,std::move(funnode));
-        std::cout<<"add ok"<<'\n';
-        std::cout<<CurTok.name<<'\n';
-      }
-      else return;
+  while (CurTok.name != "$" && CurTok.Attr != TokenAttr::EndOfFile){
+    if (CurTok.name != "def") {
+      ParseError("Excepted def!");
+      getNextToken();
+      synchronize();
+      continue;
+    }
+    if (funnode = ParseFunDef()) {
+      Log(2)<<"parse fun ok"<<'\n';
+      addNode(Root,std::move(funnode));
+      Log(2)<<"add ok"<<'\n';
+      Log(2)<<CurTok.name<<'\n';
     }
-    //getNextToken();
+    else synchronize();
   }
-  return;
+  return Diags.empty();
 }
 
 void Parser::PrintAst(std::unique_ptr<ProgNode>& root){
-  std::cout<<"start printing Ast"<<'\n';
-  root->printinfo();
+  Log(1)<<"start printing Ast"<<'\n';
+  DumpAst(*root, DumpFormat::Text, outs());
 }
 
-void Parser::PrintIR(std::unique_ptr<ProgNode>& root){
-  std::cout<<"start printing IR"<<'\n';
-  root->codegen();
+bool Parser::PrintIR(std::unique_ptr<ProgNode>& root){
+  Log(1)<<"start printing IR"<<'\n';
+  return root->codegen() != nullptr;
 }
@@ -7,6 +7,21 @@
 
 
 
+/// MaxNestingDepth - How deeply the parser may recurse into one expression:
+/// primaries inside primaries, and right operands that take an operator of
+/// their own.  Each adds at most one level to the tree, which keeps parsed
+/// trees within MaxTreeDepth; left folds (a + b + c ...) are a loop and
+/// don't count.
+const unsigned MaxNestingDepth = 2000;
+
+/// Diagnostic - One parse error and the source span it points at.
+struct Diagnostic {
+  int Line, Col;   // first character of the offending token
+  int EndCol;      // one past its last character, on the same line
+  std::string Message;
+};
+
+
 class Parser{
   Token CurTok;
   int index;
@@ -14,8 +29,21 @@ class Parser{
   Lexer lexer;
   std::string filename;
   std::vector<Token> TokVec;
+  std::vector<Diagnostic> Diags;
+  bool Panicking = false;  // inside a definition that already failed
+  int LastLine = 0, LastEndCol = 0;  // where the last token eaten ends
+  unsigned Depth = 0;  // open primaries and right operands
+  SourceMap* Locs = nullptr;  // Root's, when locations are recorded
+
+  void synchronize();
+  /// mark - Record that node runs from line:col to the end of the last token
+  /// eaten (LastLine:LastEndCol).
+  void mark(const Node* node, int line, int col);
 public:
-  Parser(const std::string& filename);
+  /// Parser - With locations, the tree comes with a SourceMap
+  /// (ProgNode::Locations).  source, if given, is filename's text.
+  Parser(const std::string& filename, bool locations = false,
+         const std::string* source = nullptr);
 
   ~Parser();
   
@@ -24,12 +52,24 @@ public:
   void getNextToken();
 
   std::unique_ptr<Node> ParseError(const std::string& message);
+
+  const std::vector<Diagnostic>& getDiagnostics() const { return Diags; }
+
+  void PrintDiagnostics(raw_ostream& OS) const;
   
   std::unique_ptr<Node> ParseVarExp();
 
   std::unique_ptr<Node> ParseNumExp();
 
-  std::unique_ptr<Node> ParseBinExp();
+  bool ParseTypeAnnotation(ValType& ty, bool allowarray = false);
+
+  int GetTokPrecedence();
+
+  std::unique_ptr<Node> ParseParenExp();
+
+  std::unique_ptr<Node> ParsePrimary();
+
+  std::unique_ptr<Node> ParseBinOpRHS(int minprec, std::unique_ptr<Node> lhs);
 
   std::unique_ptr<Node> ParseCalleeExp();
   
@@ -37,17 +77,24 @@ public:
   
   std::unique_ptr<Node> ParseIfExp();
 
+  std::unique_ptr<Node> ParseForExp();
+
+  std::unique_ptr<Node> ParseWhileExp();
+
+  std::unique_ptr<Node> ParseBlockExp();
+
   std::unique_ptr<Node> ParseExp();
   
   std::unique_ptr<Node> ParseStmtList();
 
   std::unique_ptr<Node> ParseFunDef();
   
-  void ParseProgram();
+  bool ParseProgram();
   
   void PrintAst(std::unique_ptr<ProgNode>& root);
   
-  void PrintIR(std::unique_ptr<ProgNode>& root);
+  /// PrintIR - Generate root's IR.  Returns false if codegen failed.
+  bool PrintIR(std::unique_ptr<ProgNode>& root);
  
 };
 
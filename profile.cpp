@@ -0,0 +1,230 @@
+#include "profile.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ProfileSummary.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+
+thread_local ProfileOptions Profiling;
+
+/// ProfState - Per-module bookkeeping while generating code.
+static thread_local struct {
+  unsigned NextSite = 0;
+  std::string Function;
+  // Instrument: every counter of the module with its key.  The entry key of
+  // the current function is only known once its sites are counted.
+  std::vector<std::pair<std::string, GlobalVariable*>> Counters;
+  size_t EntryCounter = 0;
+  // Timing: the { name, id } record the runtime identifies the function by.
+  GlobalVariable* TimedFunction = nullptr;
+  // Use: the counts of this function, entry count first, for the summary.
+  std::vector<uint64_t> FunctionCounts;
+  std::vector<std::vector<uint64_t>> Records;
+} ProfState;
+
+
+bool LoadProfile(const std::string& filename, ProfileCounts& counts, std::string& error) {
+  auto Buf = MemoryBuffer::getFile(filename);
+  if (!Buf) {
+    error = filename + ": " + Buf.getError().message();
+    return false;
+  }
+
+  SmallVector<StringRef, 0> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    StringRef Key, Count;
+    std::tie(Key, Count) = Line.trim().rsplit(' ');
+    uint64_t N;
+    if (Key.empty() || Count.getAsInteger(10, N)) {
+      error = filename + ": malformed line '" + Line.str() + "'";
+      return false;
+    }
+    counts[Key.str()] += N;
+  }
+  return true;
+}
+
+static uint64_t LookupCount(const std::string& key) {
+  auto It = Profiling.Use->find(key);
+  return It == Profiling.Use->end() ? 0 : It->second;
+}
+
+static std::string SiteKey(char kind, unsigned site) {
+  return std::string(1, kind) + ':' + Profiling.Module + ':' + ProfState.Function + ':' +
+         std::to_string(site);
+}
+
+/// EmitCounter - Atomically bump a fresh counter for key.
+static void EmitCounter(const std::string& key) {
+  Type* I64 = Type::getInt64Ty(*TheContext);
+  auto* G = new GlobalVariable(*TheModule, I64, false, GlobalValue::InternalLinkage,
+                               ConstantInt::get(I64, 0), "__kprof." + key);
+  ProfState.Counters.push_back({key, G});
+  Builder->CreateAtomicRMW(AtomicRMWInst::Add, G, ConstantInt::get(I64, 1),
+                           MaybeAlign(8), AtomicOrdering::Monotonic);
+}
+
+/// EmitTimingCall - fn(record, cycle counter).
+static void EmitTimingCall(StringRef fn) {
+  Type* I64 = Type::getInt64Ty(*TheContext);
+  Type* I8Ptr = Type::getInt8PtrTy(*TheContext);
+  FunctionCallee Callee = TheModule->getOrInsertFunction(fn,
+    Type::getVoidTy(*TheContext), I8Ptr, I64);
+  Function* Cycles = Intrinsic::getDeclaration(TheModule.get(), Intrinsic::readcyclecounter);
+  Builder->CreateCall(Callee, {Builder->CreatePointerCast(ProfState.TimedFunction, I8Ptr),
+                               Builder->CreateCall(Cycles)});
+}
+
+
+void BeginFunctionProfile(Function* F) {
+  ProfState.NextSite = 0;
+  ProfState.Function = F->getName().str();
+  ProfState.FunctionCounts.assign(1, 0);
+  if (Profiling.Instrument) {
+    ProfState.EntryCounter = ProfState.Counters.size();
+    EmitCounter("E:" + Profiling.Module + ':' + ProfState.Function);
+  }
+
+  if (Profiling.Timing) {
+    // Written by the runtime, which assigns the id on first entry.
+    Type* I32 = Type::getInt32Ty(*TheContext);
+    StructType* RecordTy = StructType::get(Type::getInt8PtrTy(*TheContext), I32);
+    Constant* Name = Builder->CreateGlobalStringPtr(ProfState.Function, "__kprof.fname",
+                                                    0, TheModule.get());
+    ProfState.TimedFunction = new GlobalVariable(*TheModule, RecordTy, false,
+      GlobalValue::InternalLinkage,
+      ConstantStruct::get(RecordTy, {Name, ConstantInt::get(I32, -1, true)}),
+      "__kprof.fn." + ProfState.Function);
+    EmitTimingCall("__kprof_enter");
+  }
+}
+
+void ExitFunctionProfile() {
+  if (Profiling.Timing)
+    EmitTimingCall("__kprof_exit");
+}
+
+unsigned NextProfileSite() {
+  return ProfState.NextSite++;
+}
+
+void CountBranch(unsigned site, bool then) {
+  if (Profiling.Instrument)
+    EmitCounter(SiteKey('B', site) + (then ? ":T" : ":F"));
+}
+
+void CountCall(unsigned site) {
+  if (Profiling.Instrument)
+    EmitCounter(SiteKey('C', site));
+}
+
+void AnnotateCall(CallInst* call, unsigned site) {
+  if (Profiling.Use && LookupCount(SiteKey('C', site)) == 0)
+    call->addFnAttr(Attribute::Cold);
+}
+
+void AnnotateBranch(BranchInst* BI, unsigned site) {
+  if (!Profiling.Use)
+    return;
+  uint64_t Then = LookupCount(SiteKey('B', site) + ":T");
+  uint64_t Else = LookupCount(SiteKey('B', site) + ":F");
+  ProfState.FunctionCounts.push_back(Then);
+  ProfState.FunctionCounts.push_back(Else);
+
+  // Branch weights are 32 bits; scale large counts down together.
+  uint64_t Max = std::max(Then, Else);
+  unsigned Shift = 0;
+  while ((Max >> Shift) > UINT32_MAX)
+    ++Shift;
+  MDBuilder MDB(*TheContext);
+  BI->setMetadata(LLVMContext::MD_prof,
+                  MDB.createBranchWeights(uint32_t(Then >> Shift), uint32_t(Else >> Shift)));
+}
+
+void FinishFunctionProfile(Function* F) {
+  std::string EntryKey = "E:" + Profiling.Module + ':' + ProfState.Function + ':' +
+                         std::to_string(ProfState.NextSite);
+  if (Profiling.Instrument)
+    ProfState.Counters[ProfState.EntryCounter].first = EntryKey;
+  if (!Profiling.Use)
+    return;
+
+  auto It = Profiling.Use->find(EntryKey);
+  if (It == Profiling.Use->end()) {
+    // Not in the profile, or profiled from different source: the weights
+    // attached to this function's sites would be wrong.
+    for (auto& BB : *F)
+      for (auto& I : BB) {
+        I.setMetadata(LLVMContext::MD_prof, nullptr);
+        if (auto* CI = dyn_cast<CallInst>(&I))
+          CI->removeFnAttr(Attribute::Cold);
+      }
+    return;
+  }
+
+  F->setEntryCount(It->second);
+  if (It->second == 0)
+    F->addFnAttr(Attribute::Cold);
+  ProfState.FunctionCounts[0] = It->second;
+  ProfState.Records.push_back(ProfState.FunctionCounts);
+}
+
+void FinishModuleProfile() {
+  if (Profiling.Use && !ProfState.Records.empty()) {
+    InstrProfSummaryBuilder SB(ProfileSummaryBuilder::DefaultCutoffs);
+    for (auto& Counts : ProfState.Records) {
+      InstrProfRecord R;
+      R.Counts = Counts;
+      SB.addRecord(R);
+    }
+    TheModule->setProfileSummary(SB.getSummary()->getMD(*TheContext),
+                                 ProfileSummary::PSK_Instr);
+  }
+
+  if (Profiling.Instrument && !ProfState.Counters.empty()) {
+    // table = [{ i8* key, i64* counter }...], handed to the runtime by a
+    // constructor, __kprof_register(table, n), and taken back by a
+    // destructor, __kprof_unregister(table), before the code goes away.
+    Type* I8Ptr = Type::getInt8PtrTy(*TheContext);
+    Type* I64Ptr = Type::getInt64PtrTy(*TheContext);
+    Type* I32 = Type::getInt32Ty(*TheContext);
+    StructType* EntryTy = StructType::get(I8Ptr, I64Ptr);
+
+    std::vector<Constant*> Entries;
+    for (auto& C : ProfState.Counters) {
+      Constant* Str = ConstantDataArray::getString(*TheContext, C.first);
+      auto* Name = new GlobalVariable(*TheModule, Str->getType(), true,
+                                      GlobalValue::PrivateLinkage, Str, "__kprof.name");
+      Entries.push_back(ConstantStruct::get(EntryTy,
+        {ConstantExpr::getPointerCast(Name, I8Ptr), C.second}));
+    }
+    ArrayType* TableTy = ArrayType::get(EntryTy, Entries.size());
+    auto* Table = new GlobalVariable(*TheModule, TableTy, true, GlobalValue::PrivateLinkage,
+                                     ConstantArray::get(TableTy, Entries), "__kprof.table");
+
+    FunctionCallee Register = TheModule->getOrInsertFunction("__kprof_register",
+      Type::getVoidTy(*TheContext), I8Ptr, I32);
+    Function* Ctor = Function::Create(FunctionType::get(Type::getVoidTy(*TheContext), false),
+                                      Function::InternalLinkage, "__kprof.init", TheModule.get());
+    IRBuilder<> B(BasicBlock::Create(*TheContext, "entry", Ctor));
+    B.CreateCall(Register, {ConstantExpr::getPointerCast(Table, I8Ptr),
+                            ConstantInt::get(I32, Entries.size())});
+    B.CreateRetVoid();
+    appendToGlobalCtors(*TheModule, Ctor, 65535);
+
+    FunctionCallee Unregister = TheModule->getOrInsertFunction("__kprof_unregister",
+      Type::getVoidTy(*TheContext), I8Ptr);
+    Function* Dtor = Function::Create(FunctionType::get(Type::getVoidTy(*TheContext), false),
+                                      Function::InternalLinkage, "__kprof.fini", TheModule.get());
+    B.SetInsertPoint(BasicBlock::Create(*TheContext, "entry", Dtor));
+    B.CreateCall(Unregister, {ConstantExpr::getPointerCast(Table, I8Ptr)});
+    B.CreateRetVoid();
+    appendToGlobalDtors(*TheModule, Dtor, 65535);
+  }
+
+  ProfState.Counters.clear();
+  ProfState.Records.clear();
+}
@@ -0,0 +1,82 @@
+#ifndef Z_PROFILE_H
+#define Z_PROFILE_H
+
+#include "ast.h"
+
+/*
+ * Profile-guided optimization.
+ *
+ * Every IfExpNode and CalleeExpNode of a function takes the next profile
+ * site number as it is generated, so an unchanged source numbers its sites
+ * the same way on every compile.  Counters are keyed by
+ *
+ *   E:<module>:<function>:<sites>   calls of the function (it has <sites> sites)
+ *   B:<module>:<function>:<site>:T  times an if took its then branch (F: else)
+ *   C:<module>:<function>:<site>    times a call site ran
+ *
+ * where <module> is the source file name without its directory, so
+ * same-named functions of different sources keep their own counts.
+ *
+ * Because the entry key includes the site count, a profile taken from
+ * different source is ignored for each function whose shape changed.  A
+ * profile file holds one "<key> <count>" pair per line; instrumented
+ * programs write it through profile_rt.cpp when they exit.
+ *
+ * Timing is separate from the counters above: every function calls
+ * __kprof_enter on entry and __kprof_exit before it returns, passing the
+ * cycle counter, and the runtime keeps per-thread call counts and self,
+ * total and caller-to-callee cycles.  The flat and call-graph report is
+ * printed when the program exits.
+ */
+
+typedef std::map<std::string, uint64_t> ProfileCounts;
+
+struct ProfileOptions {
+  /// Module - The <module> part of every key.
+  std::string Module;
+  /// Instrument - Emit counters and register them with the runtime.
+  bool Instrument = false;
+  /// Use - Annotate the IR with branch weights and entry counts from here.
+  const ProfileCounts* Use = nullptr;
+  /// Timing - Report calls and cycles per function when the program exits.
+  bool Timing = false;
+};
+
+extern thread_local ProfileOptions Profiling;
+
+
+/// LoadProfile - Read (and add up) the counts in filename.
+bool LoadProfile(const std::string& filename, ProfileCounts& counts, std::string& error);
+
+/// BeginFunctionProfile - Restart site numbering for F and count its entry.
+void BeginFunctionProfile(Function* F);
+
+/// ExitFunctionProfile - Stop F's timer at the current insertion point, just
+/// before it returns.
+void ExitFunctionProfile();
+
+/// NextProfileSite - Number of the next branch or call site.
+unsigned NextProfileSite();
+
+/// CountBranch - Count one arm of if site at the current insertion point.
+void CountBranch(unsigned site, bool then);
+
+/// CountCall - Count call site at the current insertion point.
+void CountCall(unsigned site);
+
+/// AnnotateCall - Mark the call at site cold if the profile says it never ran.
+void AnnotateCall(CallInst* call, unsigned site);
+
+/// AnnotateBranch - Attach the profiled weights of if site to BI.
+void AnnotateBranch(BranchInst* BI, unsigned site);
+
+/// FinishFunctionProfile - Attach F's entry count, or drop its annotations
+/// when the profile does not match F.
+void FinishFunctionProfile(Function* F);
+
+/// FinishModuleProfile - Register the module's counters with the runtime,
+/// or attach the profile summary the optimizer needs to tell hot from cold.
+void FinishModuleProfile();
+
+
+#endif
@@ -0,0 +1,276 @@
+// Runtime for programs built with -fprofile-generate or -pg.  Link the
+// objects with libKProfRuntime.a (the JIT binds it itself).  Counts are
+// added to $KPROF_FILE (default "default.kprof") when the program exits;
+// the -pg report goes to $KPROF_REPORT, or stderr.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct KProfEntry {
+  const char* Key;
+  const uint64_t* Counter;
+};
+
+// Registration runs from other objects' constructors, possibly before this
+// file's globals are initialized, hence the function-local statics.  Those
+// WriteProfile reads are never destroyed: it runs at exit, possibly after
+// statics created later would have been.
+std::mutex& Lock() {
+  static std::mutex M;
+  return M;
+}
+
+std::vector<std::pair<const KProfEntry*, int32_t>>& Tables() {
+  static auto* T = new std::vector<std::pair<const KProfEntry*, int32_t>>;
+  return *T;
+}
+
+// Retired - Counts of tables unregistered before exit, when the code that
+// owns them is unloaded (as a JIT does).
+std::map<std::string, uint64_t>& Retired() {
+  static auto* R = new std::map<std::string, uint64_t>;
+  return *R;
+}
+
+void WriteProfile() {
+  const char* env = getenv("KPROF_FILE");
+  std::string path = env ? env : "default.kprof";
+
+  std::map<std::string, uint64_t> counts;
+  {
+    // Earlier runs are merged in, so a profile can cover several inputs.
+    std::ifstream in(path);
+    std::string key;
+    uint64_t n;
+    while (in >> key >> n)
+      counts[key] += n;
+  }
+
+  std::lock_guard<std::mutex> G(Lock());
+  for (auto& R : Retired())
+    counts[R.first] += R.second;
+  for (auto& T : Tables())
+    for (int32_t i = 0; i != T.second; ++i)
+      counts[T.first[i].Key] += __atomic_load_n(T.first[i].Counter, __ATOMIC_RELAXED);
+
+  FILE* out = fopen(path.c_str(), "w");
+  if (!out) {
+    perror(path.c_str());
+    return;
+  }
+  for (auto& C : counts)
+    fprintf(out, "%s %llu\n", C.first.c_str(), (unsigned long long)C.second);
+  fclose(out);
+}
+
+
+// -pg: every instrumented function owns one of these.  Id is -1 until the
+// function first runs.
+struct KProfFunction {
+  const char* Name;
+  int32_t Id;
+};
+
+struct FunctionTimes {
+  uint64_t Calls = 0;
+  uint64_t Self = 0;
+  uint64_t Total = 0;
+  // Active - Frames of the function on the stack; only the outermost one of
+  // a recursion adds to Total.
+  unsigned Active = 0;
+};
+
+struct EdgeTimes {
+  uint64_t Calls = 0;
+  uint64_t Cycles = 0;
+};
+
+struct Frame {
+  int32_t Id;
+  uint64_t Start;
+  uint64_t Children;
+};
+
+struct TimeProfile {
+  // Copied: JITed code, and its names, may be gone by the time we report.
+  std::vector<std::string> Names;
+  std::vector<FunctionTimes> Functions;
+  // Key - caller id << 32 | callee id; calls from outside are caller -1.
+  std::unordered_map<uint64_t, EdgeTimes> Edges;
+};
+
+// Threads' buffers are merged into this one as they exit.  Never destroyed,
+// so threads that outlive main can still flush.
+TimeProfile& GlobalTimes() {
+  static TimeProfile* T = new TimeProfile;
+  return *T;
+}
+
+uint64_t EdgeKey(int32_t caller, int32_t callee) {
+  return uint64_t(uint32_t(caller)) << 32 | uint32_t(callee);
+}
+
+/// ThreadTimes - Written without locking by one thread.
+struct ThreadTimes {
+  std::vector<FunctionTimes> Functions;
+  std::unordered_map<uint64_t, EdgeTimes> Edges;
+  std::vector<Frame> Stack;
+
+  FunctionTimes& get(int32_t id) {
+    if (size_t(id) >= Functions.size())
+      Functions.resize(id + 1);
+    return Functions[id];
+  }
+
+  ~ThreadTimes() {
+    std::lock_guard<std::mutex> G(Lock());
+    TimeProfile& T = GlobalTimes();
+    if (T.Functions.size() < Functions.size())
+      T.Functions.resize(Functions.size());
+    for (size_t i = 0; i != Functions.size(); ++i) {
+      T.Functions[i].Calls += Functions[i].Calls;
+      T.Functions[i].Self += Functions[i].Self;
+      T.Functions[i].Total += Functions[i].Total;
+    }
+    for (auto& E : Edges) {
+      T.Edges[E.first].Calls += E.second.Calls;
+      T.Edges[E.first].Cycles += E.second.Cycles;
+    }
+  }
+};
+
+thread_local ThreadTimes Times;
+
+void WriteTimeReport() {
+  const char* env = getenv("KPROF_REPORT");
+  FILE* out = env ? fopen(env, "w") : stderr;
+  if (!out) {
+    perror(env);
+    return;
+  }
+
+  // The main thread's buffer is already merged: thread_local destructors
+  // run before atexit handlers.
+  std::lock_guard<std::mutex> G(Lock());
+  TimeProfile& T = GlobalTimes();
+  T.Functions.resize(T.Names.size());
+  uint64_t AllSelf = 0;
+  std::vector<int32_t> Order;
+  for (size_t i = 0; i != T.Functions.size(); ++i) {
+    AllSelf += T.Functions[i].Self;
+    Order.push_back(int32_t(i));
+  }
+  std::sort(Order.begin(), Order.end(), [&](int32_t a, int32_t b) {
+    return T.Functions[a].Self > T.Functions[b].Self;
+  });
+
+  fprintf(out, "Flat profile:\n");
+  fprintf(out, "%7s %18s %18s %12s  %s\n", "%self", "self cycles", "total cycles", "calls",
+          "function");
+  for (int32_t i : Order) {
+    const FunctionTimes& F = T.Functions[i];
+    fprintf(out, "%7.2f %18llu %18llu %12llu  %s\n",
+            AllSelf ? 100.0 * F.Self / AllSelf : 0.0, (unsigned long long)F.Self,
+            (unsigned long long)F.Total, (unsigned long long)F.Calls, T.Names[i].c_str());
+  }
+
+  // Callers of each function, hottest function first.
+  fprintf(out, "\nCall graph:\n");
+  fprintf(out, "%12s %18s  %s\n", "calls", "cycles", "caller -> callee");
+  for (int32_t i : Order) {
+    std::vector<std::pair<int32_t, EdgeTimes>> Callers;
+    for (auto& E : T.Edges)
+      if (int32_t(uint32_t(E.first)) == i)
+        Callers.push_back({int32_t(E.first >> 32), E.second});
+    std::sort(Callers.begin(), Callers.end(), [](const auto& a, const auto& b) {
+      return a.second.Cycles > b.second.Cycles;
+    });
+    for (auto& C : Callers)
+      fprintf(out, "%12llu %18llu  %s -> %s\n", (unsigned long long)C.second.Calls,
+              (unsigned long long)C.second.Cycles,
+              C.first < 0 ? "<external>" : T.Names[C.first].c_str(), T.Names[i].c_str());
+  }
+
+  if (out != stderr)
+    fclose(out);
+}
+
+int32_t AssignId(KProfFunction* fn) {
+  std::lock_guard<std::mutex> G(Lock());
+  int32_t Id = __atomic_load_n(&fn->Id, __ATOMIC_ACQUIRE);
+  if (Id >= 0)
+    return Id;
+  TimeProfile& T = GlobalTimes();
+  if (T.Names.empty())
+    atexit(WriteTimeReport);
+  Id = int32_t(T.Names.size());
+  T.Names.push_back(fn->Name);
+  __atomic_store_n(&fn->Id, Id, __ATOMIC_RELEASE);
+  return Id;
+}
+
+} // namespace
+
+extern "C" void __kprof_enter(KProfFunction* fn, uint64_t cycles) {
+  int32_t Id = __atomic_load_n(&fn->Id, __ATOMIC_ACQUIRE);
+  if (Id < 0)
+    Id = AssignId(fn);
+  FunctionTimes& F = Times.get(Id);
+  ++F.Calls;
+  ++F.Active;
+  int32_t Caller = Times.Stack.empty() ? -1 : Times.Stack.back().Id;
+  ++Times.Edges[EdgeKey(Caller, Id)].Calls;
+  Times.Stack.push_back({Id, cycles, 0});
+}
+
+extern "C" void __kprof_exit(KProfFunction* fn, uint64_t cycles) {
+  if (Times.Stack.empty() || Times.Stack.back().Id != fn->Id)
+    return;
+  Frame Top = Times.Stack.back();
+  Times.Stack.pop_back();
+
+  uint64_t Elapsed = cycles - Top.Start;
+  FunctionTimes& F = Times.get(Top.Id);
+  F.Self += Elapsed - std::min(Elapsed, Top.Children);
+  if (--F.Active == 0)
+    F.Total += Elapsed;
+
+  int32_t Caller = -1;
+  if (!Times.Stack.empty()) {
+    Times.Stack.back().Children += Elapsed;
+    Caller = Times.Stack.back().Id;
+  }
+  Times.Edges[EdgeKey(Caller, Top.Id)].Cycles += Elapsed;
+}
+
+extern "C" void __kprof_register(const KProfEntry* table, int32_t n) {
+  std::lock_guard<std::mutex> G(Lock());
+  static bool AtExit = false;
+  if (!AtExit) {
+    atexit(WriteProfile);
+    AtExit = true;
+  }
+  Tables().push_back({table, n});
+}
+
+extern "C" void __kprof_unregister(const KProfEntry* table) {
+  std::lock_guard<std::mutex> G(Lock());
+  auto& T = Tables();
+  for (auto It = T.begin(); It != T.end(); ++It)
+    if (It->first == table) {
+      for (int32_t i = 0; i != It->second; ++i)
+        Retired()[table[i].Key] += __atomic_load_n(table[i].Counter, __ATOMIC_RELAXED);
+      T.erase(It);
+      return;
+    }
+}
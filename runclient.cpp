@@ -0,0 +1,81 @@
+#include "server.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <unistd.h>
+
+using namespace llvm;
+
+
+static int Usage() {
+	errs() << "usage: Client [-socket PATH] compile [-O0..-O3] [-emit-llvm] INPUT [-o OUTPUT]\n"
+	       << "       Client [-socket PATH] stats | shutdown\n";
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	std::string path = DefaultSocketPath();
+	int i = 1;
+	if (i + 1 < argc && std::string(argv[i]) == "-socket") {
+		path = argv[i + 1];
+		i += 2;
+	}
+	if (i >= argc)
+		return Usage();
+
+	std::string command = argv[i++];
+	std::string request = command;
+	if (command == "compile") {
+		unsigned optlevel = 0;
+		bool bitcode = false;
+		SmallString<256> input, output;
+		for (; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && isdigit(arg[2]))
+				optlevel = arg[2] - '0';
+			else if (arg == "-emit-llvm")
+				bitcode = true;
+			else if (arg == "-o" && i + 1 < argc)
+				output = argv[++i];
+			else if (input.empty())
+				input = arg;
+			else
+				return Usage();
+		}
+		if (input.empty())
+			return Usage();
+		if (output.empty()) {
+			output = input;
+			sys::path::replace_extension(output, bitcode ? ".bc" : ".o");
+		}
+		// The server has its own working directory.
+		sys::fs::make_absolute(input);
+		sys::fs::make_absolute(output);
+		request += " " + std::to_string(optlevel) + (bitcode ? " bc " : " obj ") +
+		           std::string(input) + " " + std::string(output);
+	} else if ((command != "stats" && command != "shutdown") || i != argc) {
+		return Usage();
+	}
+
+	std::string error, reply;
+	int fd = ConnectTo(path, error);
+	if (fd < 0) {
+		errs() << "error: " << error << '\n';
+		return 1;
+	}
+	if (!SendLine(fd, request) || !RecvLine(fd, reply)) {
+		errs() << "error: no reply from server\n";
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	if (reply.compare(0, 6, "error ") == 0) {
+		errs() << "error: " << reply.substr(6) << '\n';
+		return 1;
+	}
+	if (command == "stats")
+		outs() << reply << '\n';
+	return 0;
+}
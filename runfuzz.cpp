@@ -0,0 +1,1126 @@
+#include "jit.h"
+#include "serialize.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SaveAndRestore.h"
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Fuzz - Differential testing of the compile pipelines.
+ *
+ * Random programs are generated from the language's grammar (functions,
+ * let, assignment, if, for, while, blocks, arithmetic and comparisons on
+ * i32, i64 and f64, conversions, host functions, calls and recursion) and
+ * every one is run through each configuration below.  All of them must
+ * agree with -O0 on the value main returns and on the AST printed after
+ * type inference; the AST must also survive SaveAst and LoadAst unchanged.
+ * Some operator chains are printed without parentheses, and must parse as
+ * the same program does with every operator parenthesized.
+ * A configuration that fails to compile (including the IR verifier), crashes
+ * or runs out of time disagrees too.
+ *
+ * Programs are well defined by construction, so any disagreement is a
+ * compiler bug: integer arithmetic wraps, division is only by a literal
+ * 2..9 unless it is f64, floating point values are never converted to
+ * integers, every loop runs a constant number of times and recursion counts
+ * a literal down.  A failing program is reduced, dropping functions and
+ * statements and replacing expressions with their operands or a literal for
+ * as long as the same configuration fails the same way, and written out
+ * with the reduced version next to it.
+ *
+ * Each configuration runs in a child process, so a crash or a hang is
+ * reported rather than fatal.
+ */
+
+namespace {
+
+/// Expr - A generated expression.  Text is the literal, variable, operator,
+/// callee or loop variable, depending on Kind; Ty is the type inference
+/// will give it.
+enum class ExprKind { Num, Var, Bin, Assign, Let, If, For, While, Call, Block };
+
+struct Expr {
+	ExprKind Kind;
+	ValType Ty;
+	std::string Text;
+	/// Annot - The declared type of a let, or Unknown.
+	ValType Annot = ValType::Unknown;
+	/// Bare - Bin: printed without parentheses where precedence allows.
+	bool Bare = false;
+	/// Kids - Bin: lhs, rhs.  Assign, Let: the value.  If: cond, then, else.
+	/// For: start, end, [step,] body.  While: trip count, body.  Call:
+	/// the arguments.  Block: the statements.
+	std::vector<Expr> Kids;
+
+	Expr(ExprKind kind = ExprKind::Block, ValType ty = ValType::Unknown, std::string text = "")
+	  : Kind(kind), Ty(ty), Text(std::move(text)) {}
+};
+
+struct Func {
+	std::string Name;
+	std::vector<std::pair<std::string, ValType>> Params;
+	ValType Ret = ValType::I32;
+	bool RetAnnot = false;
+	/// Rec - Counts its first parameter down to zero.
+	bool Rec = false;
+	std::vector<Expr> Body;
+	/// Cost - Roughly how many expressions one call evaluates.
+	uint64_t Cost = 0;
+};
+
+typedef std::vector<Func> Program;
+
+Expr Num(ValType ty, std::string text) {
+	return Expr(ExprKind::Num, ty, std::move(text));
+}
+
+Expr Var(ValType ty, std::string name) {
+	return Expr(ExprKind::Var, ty, std::move(name));
+}
+
+Expr Bin(char op, Expr lhs, Expr rhs) {
+	ValType Ty = (op == '<' || op == '>') ? ValType::I32 : Widen(lhs.Ty, rhs.Ty);
+	Expr E{ExprKind::Bin, Ty, std::string(1, op)};
+	E.Kids.push_back(std::move(lhs));
+	E.Kids.push_back(std::move(rhs));
+	return E;
+}
+
+std::string Printf(const char* fmt, double x) {
+	char Buf[64];
+	snprintf(Buf, sizeof(Buf), fmt, x);
+	return Buf;
+}
+
+/// Simplest - 0 of type ty.
+Expr Simplest(ValType ty) {
+	if (ty == ValType::I32)
+		return Num(ty, "0");
+	if (ty == ValType::F64)
+		return Num(ty, "0.0");
+	Expr E{ExprKind::Call, ty, "i64"};
+	E.Kids.push_back(Num(ValType::I32, "0"));
+	return E;
+}
+
+
+// Rendering.  Operators are parenthesized unless they are Bare, which are
+// left to precedence, and whatever could swallow what follows it is
+// parenthesized where it is an operand.  The same program with every
+// operator parenthesized is the expected parse of a bare one.
+
+/// Parenthesize - Parenthesize Bare operators too.
+bool Parenthesize = false;
+
+/// Precedence - How tightly op binds, as the parser has it.  All are left
+/// associative.
+unsigned Precedence(const std::string& op) {
+	switch (op[0]) {
+	case '<':
+	case '>':
+		return 10;
+	case '+':
+	case '-':
+		return 20;
+	default:
+		return 40;
+	}
+}
+
+std::string Render(const Expr& e);
+
+std::string Operand(const Expr& e) {
+	switch (e.Kind) {
+	case ExprKind::Assign:
+	case ExprKind::Let:
+	case ExprKind::If:
+	case ExprKind::For:
+		return "(" + Render(e) + ")";
+	default:
+		return Render(e);
+	}
+}
+
+/// Juxtapose - Expressions side by side, as statements and arguments are.
+/// One ending in a name would call itself with a parenthesized one
+/// following it, so it is parenthesized too (which may in turn call for the
+/// one before it to be).
+std::string Juxtapose(std::vector<std::string> items) {
+	for (size_t i = items.size(); i-- > 1;)
+		if (isalnum(items[i - 1].back()) && items[i][0] == '(')
+			items[i - 1] = "(" + items[i - 1] + ")";
+	return join(items, " ");
+}
+
+std::string RenderList(const std::vector<Expr>& es) {
+	std::vector<std::string> Items;
+	for (auto& e : es)
+		Items.push_back(Render(e));
+	return Juxtapose(Items);
+}
+
+std::string Render(const Expr& e) {
+	switch (e.Kind) {
+	case ExprKind::Num:
+	case ExprKind::Var:
+		return e.Text;
+	case ExprKind::Bin: {
+		// A bare operand binding less tightly, or on the right as tightly,
+		// is parenthesized after all.
+		unsigned Prec = Precedence(e.Text);
+		auto Side = [](const Expr& kid, unsigned min) {
+			std::string S = Operand(kid);
+			bool Bare = kid.Kind == ExprKind::Bin && kid.Bare && !Parenthesize;
+			return Bare && Precedence(kid.Text) < min ? "(" + S + ")" : S;
+		};
+		std::string S = Side(e.Kids[0], Prec) + " " + e.Text + " " + Side(e.Kids[1], Prec + 1);
+		return e.Bare && !Parenthesize ? S : "(" + S + ")";
+	}
+	case ExprKind::Assign:
+		return e.Text + " = " + Render(e.Kids[0]);
+	case ExprKind::Let:
+		return "let " + e.Text +
+		       (e.Annot != ValType::Unknown ? std::string(":") + TypeName(e.Annot) : "") +
+		       " = " + Render(e.Kids[0]);
+	case ExprKind::If:
+		return "if " + Operand(e.Kids[0]) + " then " + Operand(e.Kids[1]) + " else " +
+		       Render(e.Kids[2]);
+	case ExprKind::For: {
+		bool Step = e.Kids.size() == 4;
+		return "for " + e.Text + " = " + Operand(e.Kids[0]) + " to " + Operand(e.Kids[1]) +
+		       (Step ? " step " + Operand(e.Kids[2]) : "") + " in " + Render(e.Kids.back());
+	}
+	case ExprKind::While:
+		// A counter that only the loop itself changes.
+		return "{ let " + e.Text + " = 0 while (" + e.Text + " < " + Render(e.Kids[0]) +
+		       ") do { " + Juxtapose({Render(e.Kids[1]),
+		                             "(" + e.Text + " = (" + e.Text + " + 1))"}) + " } }";
+	case ExprKind::Call: {
+		std::vector<std::string> Args;
+		for (auto& arg : e.Kids)
+			Args.push_back(Operand(arg));
+		return e.Text + "(" + Juxtapose(Args) + ")";
+	}
+	case ExprKind::Block:
+		return "{ " + RenderList(e.Kids) + " }";
+	}
+	return "";
+}
+
+std::string Render(const Program& prog, bool parenthesize = false) {
+	SaveAndRestore<bool> Saved(Parenthesize, parenthesize);
+	std::string S;
+	for (auto& F : prog) {
+		S += "def " + F.Name + "(";
+		for (size_t i = 0; i != F.Params.size(); ++i) {
+			S += (i ? " " : "") + F.Params[i].first;
+			if (F.Params[i].second != ValType::I32)
+				S += std::string(":") + TypeName(F.Params[i].second);
+		}
+		S += ")";
+		if (F.RetAnnot)
+			S += std::string(":") + TypeName(F.Ret);
+		S += "\n  " + RenderList(F.Body) + ";\n\n";
+	}
+	return S + "$\n";
+}
+
+
+/// Shape - How big and how deep generated programs are.
+struct Shape {
+	unsigned Funcs = 6;
+	unsigned Stmts = 4;
+	unsigned Depth = 4;
+	/// Nest - With this set, main is one expression nested this deep instead.
+	unsigned Nest = 0;
+};
+
+class Generator {
+	std::mt19937_64 Rng;
+	Shape S;
+	Program Prog;
+
+	struct VarInfo {
+		std::string Name;
+		ValType Ty;
+		bool Mutable;
+	};
+	std::vector<VarInfo> Scope;
+	unsigned Names = 0;
+	unsigned Loops = 0;
+	/// Mult - How often the code being generated runs per call.
+	uint64_t Mult = 1;
+	Func* Cur = nullptr;
+
+	static constexpr uint64_t Budget = 1 << 20;
+	static constexpr unsigned MaxRec = 8;
+
+	unsigned Pick(unsigned n) { return Rng() % n; }
+	bool Chance(unsigned percent) { return Pick(100) < percent; }
+	std::string Fresh(const char* prefix) { return prefix + std::to_string(Names++); }
+
+	ValType AnyType() {
+		static const ValType Types[] = {ValType::I32, ValType::I32, ValType::I64, ValType::F64};
+		return Types[Pick(4)];
+	}
+
+	/// NotWider - i32 or another type no wider than t.
+	ValType NotWider(ValType t) {
+		return ValType(uint8_t(ValType::I32) + Pick(uint8_t(t) - uint8_t(ValType::I32) + 1));
+	}
+
+	Expr Literal(ValType t) {
+		static const char* const I32s[] = {"0", "1", "2", "3", "5", "7", "10", "42", "255",
+		                                   "1000", "65535", "2147483647"};
+		static const char* const I64s[] = {"2147483648", "4294967296", "4294967297",
+		                                   "1099511627776", "9223372036854775807"};
+		static const char* const F64s[] = {"0.0", "0.5", "1.0", "1.5", "2.25", "3.0", "10.0",
+		                                   "0.125", "1e10", "2.5e-3", "1e300"};
+		if (t == ValType::I32)
+			return Num(t, I32s[Pick(std::size(I32s))]);
+		if (t == ValType::I64)
+			return Num(t, I64s[Pick(std::size(I64s))]);
+		return Num(t, F64s[Pick(std::size(F64s))]);
+	}
+
+	Expr Leaf(ValType t) {
+		std::vector<const VarInfo*> Vars;
+		for (auto& V : Scope)
+			if (V.Ty == t)
+				Vars.push_back(&V);
+		if (!Vars.empty() && Chance(60)) {
+			const VarInfo* V = Vars[Pick(Vars.size())];
+			return Var(t, V->Name);
+		}
+		return Literal(t);
+	}
+
+	Expr Call(std::string name, ValType t, std::vector<Expr> args) {
+		Expr E{ExprKind::Call, t, std::move(name)};
+		E.Kids = std::move(args);
+		return E;
+	}
+
+	/// Convert - e as type t, however it was typed.
+	Expr Convert(ValType t, Expr e) {
+		return Call(TypeName(t), t, {std::move(e)});
+	}
+
+	/// Chain - e, left to precedence half the time.
+	Expr Chain(Expr e) {
+		e.Bare = Chance(50);
+		return e;
+	}
+
+	/// Upto - An expression of type t or narrower.
+	Expr Upto(ValType t, unsigned depth) {
+		return Exact(NotWider(t), depth);
+	}
+
+	/// Arith - t = one operand of t and another no wider.
+	Expr Arith(ValType t, unsigned depth) {
+		char Op = "+-*/"[Pick(4)];
+		if (Op == '/' && t != ValType::F64)
+			return Chain(Bin('/', Exact(t, depth - 1), Num(ValType::I32, std::to_string(2 + Pick(8)))));
+		Expr A = Exact(t, depth - 1), B = Upto(t, depth - 1);
+		if (Chance(50))
+			std::swap(A, B);
+		return Chain(Bin(Op, std::move(A), std::move(B)));
+	}
+
+	Expr Exact(ValType t, unsigned depth) {
+		Cur->Cost += Mult;
+		if (depth == 0 || Chance(20))
+			return Leaf(t);
+		switch (Pick(10)) {
+		case 0:
+			if (t == ValType::I32)
+				return Chain(Bin(Chance(50) ? '<' : '>', Exact(AnyType(), depth - 1),
+				                 Exact(AnyType(), depth - 1)));
+			break;
+		case 1: {
+			Expr Then = Exact(t, depth - 1), Else = Upto(t, depth - 1);
+			if (Chance(50))
+				std::swap(Then, Else);
+			Expr E{ExprKind::If, t};
+			E.Kids.push_back(Exact(AnyType(), depth - 1));
+			E.Kids.push_back(std::move(Then));
+			E.Kids.push_back(std::move(Else));
+			return E;
+		}
+		case 2:
+			// Widening, truncating i64 to i32, or a no-op; never from f64.
+			return Convert(t, Exact(Chance(50) ? ValType::I32 : ValType::I64, depth - 1));
+		case 3:
+			if (Expr E; CallSome(t, depth, E))
+				return E;
+			break;
+		case 4: {
+			Expr E{ExprKind::Block, t};
+			size_t Saved = Scope.size();
+			for (unsigned n = Pick(3); n; --n)
+				E.Kids.push_back(Stmt(depth - 1));
+			E.Kids.push_back(Exact(t, depth - 1));
+			Scope.resize(Saved);
+			return E;
+		}
+		case 5: {
+			// Not visible afterwards: it may not have run.
+			Expr E{ExprKind::Let, t, Fresh("v")};
+			if (Chance(50)) {
+				E.Annot = t;
+				E.Kids.push_back(Upto(t, depth - 1));
+			} else {
+				E.Kids.push_back(Exact(t, depth - 1));
+			}
+			return E;
+		}
+		case 6: {
+			std::vector<const VarInfo*> Vars;
+			for (auto& V : Scope)
+				if (V.Ty == t && V.Mutable)
+					Vars.push_back(&V);
+			if (Vars.empty())
+				break;
+			Expr E{ExprKind::Assign, t, Vars[Pick(Vars.size())]->Name};
+			E.Kids.push_back(Upto(t, depth - 1));
+			return E;
+		}
+		case 7:
+			if (t == ValType::F64) {
+				static const char* const Host[] = {"sqrt", "fabs", "floor"};
+				return Call(Host[Pick(3)], t, {Upto(t, depth - 1)});
+			}
+			break;
+		}
+		return Arith(t, depth);
+	}
+
+	/// CallSome - A call to an earlier function returning t that fits the
+	/// budget, if there is one.
+	bool CallSome(ValType t, unsigned depth, Expr& call) {
+		std::vector<const Func*> Callees;
+		for (const Func& F : Prog)
+			if (&F != Cur && F.Ret == t && Cur->Cost + Mult * F.Cost <= Budget)
+				Callees.push_back(&F);
+		if (Callees.empty())
+			return false;
+		const Func* F = Callees[Pick(Callees.size())];
+		Cur->Cost += Mult * F->Cost;
+		std::vector<Expr> Args;
+		for (size_t i = 0; i != F->Params.size(); ++i)
+			Args.push_back(i == 0 && F->Rec ? Num(ValType::I32, std::to_string(Pick(MaxRec + 1)))
+			                                : Upto(F->Params[i].second, depth - 1));
+		call = Call(F->Name, t, std::move(Args));
+		return true;
+	}
+
+	/// Loop - A for or while running its body a few times.
+	Expr Loop(unsigned depth) {
+		unsigned Trips = Pick(5);
+		uint64_t Saved = Mult;
+		Mult *= std::max(Trips, 1u);
+		++Loops;
+		size_t SavedScope = Scope.size();
+		Expr E;
+		if (Chance(30)) {
+			E = {ExprKind::While, ValType::I32, Fresh("w")};
+			E.Kids.push_back(Num(ValType::I32, std::to_string(Trips)));
+			Scope.push_back({E.Text, ValType::I32, false});
+		} else {
+			E = {ExprKind::For, ValType::I32, Fresh("k")};
+			ValType VarTy = AnyType();
+			if (VarTy == ValType::F64) {
+				// Steps of 0.5 add up exactly.
+				E.Kids.push_back(Num(VarTy, "0.5"));
+				E.Kids.push_back(Num(VarTy, Printf("%.1f", 0.5 + 0.5 * Trips)));
+				E.Kids.push_back(Num(VarTy, "0.5"));
+			} else {
+				unsigned Start = Pick(4), Step = 1 + Pick(3);
+				E.Kids.push_back(Num(ValType::I32, std::to_string(Start)));
+				std::string End = std::to_string(Start + Trips * Step);
+				E.Kids.push_back(VarTy == ValType::I64 ? Convert(VarTy, Num(ValType::I32, End))
+				                                      : Num(ValType::I32, End));
+				if (Step != 1 || Chance(30))
+					E.Kids.push_back(Num(ValType::I32, std::to_string(Step)));
+			}
+			Scope.push_back({E.Text, VarTy, false});
+		}
+		Expr Body{ExprKind::Block, ValType::I32};
+		for (unsigned n = 1 + Pick(3); n; --n)
+			Body.Kids.push_back(Stmt(depth));
+		Body.Ty = Body.Kids.back().Ty;
+		E.Kids.push_back(std::move(Body));
+		Scope.resize(SavedScope);
+		--Loops;
+		Mult = Saved;
+		return E;
+	}
+
+	/// Stmt - A statement; a let adds its variable to the scope.
+	Expr Stmt(unsigned depth) {
+		unsigned Kind = Pick(10);
+		if (Kind < 4) {
+			ValType T = AnyType();
+			Expr E{ExprKind::Let, T, Fresh("v")};
+			if (Chance(40)) {
+				E.Annot = T;
+				E.Kids.push_back(Upto(T, depth));
+			} else {
+				E.Kids.push_back(Exact(T, depth));
+			}
+			Scope.push_back({E.Text, T, true});
+			return E;
+		}
+		if (Kind < 6 && Loops < 2 && depth)
+			return Loop(depth - 1);
+		if (Kind < 8) {
+			std::vector<const VarInfo*> Vars;
+			for (auto& V : Scope)
+				if (V.Mutable)
+					Vars.push_back(&V);
+			if (!Vars.empty()) {
+				const VarInfo* V = Vars[Pick(Vars.size())];
+				Expr E{ExprKind::Assign, V->Ty, V->Name};
+				E.Kids.push_back(Upto(V->Ty, depth));
+				return E;
+			}
+		}
+		return Exact(AnyType(), depth);
+	}
+
+	void Body(Func& F, unsigned stmts) {
+		for (unsigned n = Pick(stmts + 1); n; --n)
+			F.Body.push_back(Stmt(S.Depth));
+		F.Body.push_back(Exact(F.Ret, S.Depth));
+	}
+
+	void Function() {
+		Prog.emplace_back();
+		Func& F = Prog.back();
+		Cur = &F;
+		F.Rec = Chance(20);
+		F.Name = Fresh(F.Rec ? "rec" : "fn");
+		F.Ret = AnyType();
+		F.RetAnnot = F.Rec || Chance(30);
+		if (F.Rec)
+			F.Params.push_back({Fresh("p"), ValType::I32});
+		for (unsigned n = Pick(4); n; --n)
+			F.Params.push_back({Fresh("p"), AnyType()});
+		Scope.clear();
+		for (size_t i = 0; i != F.Params.size(); ++i)
+			Scope.push_back({F.Params[i].first, F.Params[i].second, !(F.Rec && i == 0)});
+
+		if (!F.Rec) {
+			Body(F, S.Stmts);
+			return;
+		}
+		// if n < 1 then base else [x op] self(n - 1 ...), evaluated up to
+		// MaxRec + 1 times a call.
+		Mult = MaxRec + 1;
+		Expr If{ExprKind::If, F.Ret};
+		const std::string& N = F.Params[0].first;
+		If.Kids.push_back(Bin('<', Var(ValType::I32, N), Num(ValType::I32, "1")));
+		If.Kids.push_back(Upto(F.Ret, S.Depth));
+		std::vector<Expr> Args{Bin('-', Var(ValType::I32, N), Num(ValType::I32, "1"))};
+		for (size_t i = 1; i != F.Params.size(); ++i)
+			Args.push_back(Upto(F.Params[i].second, S.Depth - 1));
+		Expr Self = Call(F.Name, F.Ret, std::move(Args));
+		if (Chance(50))
+			If.Kids.push_back(std::move(Self));
+		else
+			If.Kids.push_back(Bin("+-*"[Pick(3)], Upto(F.Ret, S.Depth - 1), std::move(Self)));
+		for (unsigned n = Pick(3); n; --n)
+			F.Body.push_back(Stmt(S.Depth - 1));
+		F.Body.push_back(std::move(If));
+		Mult = 1;
+	}
+
+	/// Nested - An expression n levels deep, for main.
+	Expr Nested(ValType t, unsigned n) {
+		Expr E = Leaf(t);
+		for (unsigned i = 0; i != n; ++i) {
+			switch (Pick(4)) {
+			case 0:
+				E = Chain(Bin("+-*"[Pick(3)], std::move(E), Leaf(t)));
+				break;
+			case 1: {
+				Expr If{ExprKind::If, t};
+				If.Kids.push_back(Bin('<', Leaf(t), Leaf(t)));
+				If.Kids.push_back(std::move(E));
+				If.Kids.push_back(Leaf(t));
+				E = std::move(If);
+				break;
+			}
+			case 2: {
+				Expr Block{ExprKind::Block, t};
+				Block.Kids.push_back(Leaf(t));
+				Block.Kids.push_back(std::move(E));
+				E = std::move(Block);
+				break;
+			}
+			default: {
+				Expr Let{ExprKind::Let, t, Fresh("v")};
+				Let.Kids.push_back(std::move(E));
+				E = std::move(Let);
+				break;
+			}
+			}
+		}
+		return E;
+	}
+
+public:
+	Generator(uint64_t seed, const Shape& shape) : Rng(seed), S(shape) {}
+
+	Program Generate() {
+		Prog.reserve(S.Funcs + 1);
+		for (unsigned i = 0; i != S.Funcs; ++i)
+			Function();
+
+		Prog.emplace_back();
+		Func& Main = Prog.back();
+		Cur = &Main;
+		Main.Name = "main";
+		Main.Ret = AnyType();
+		Scope.clear();
+		if (S.Nest)
+			Main.Body.push_back(Nested(Main.Ret, S.Nest));
+		else
+			Body(Main, S.Stmts * 2);
+		return std::move(Prog);
+	}
+};
+
+
+// Running.
+
+struct Config {
+	const char* Name;
+	unsigned OptLevel;
+	unsigned Partitions;
+	enum { Plain, Parenthesized, DebugInfo, TimeProfile, ProfileGenerate, ProfileUse, Roundtrip } Kind;
+};
+
+// The first is the reference; Parenthesized compiles the program with every
+// operator parenthesized and ProfileUse reads what ProfileGenerate wrote.
+const Config Configs[] = {
+	{"-O0", 0, 1, Config::Plain},
+	{"-O0 parenthesized", 0, 1, Config::Parenthesized},
+	{"-O1", 1, 1, Config::Plain},
+	{"-O2", 2, 1, Config::Plain},
+	{"-O3", 3, 1, Config::Plain},
+	{"-O2 -split 3", 2, 3, Config::Plain},
+	{"-O2 -g", 2, 1, Config::DebugInfo},
+	{"-O1 -pg", 1, 1, Config::TimeProfile},
+	{"-O0 -fprofile-generate", 0, 1, Config::ProfileGenerate},
+	{"-O2 -fprofile-use", 2, 1, Config::ProfileUse},
+	{"-O2 save/load AST", 2, 1, Config::Roundtrip},
+};
+
+unsigned Timeout = 10;
+
+/// ParenFile - Where the parenthesized version of file is.  A replayed file
+/// has none, and stands for itself.
+std::string ParenFile(const std::string& file) {
+	std::string P = file + ".paren";
+	return sys::fs::exists(P) ? P : file;
+}
+
+/// WriteProgram - prog to file, and parenthesized next to it.
+bool WriteProgram(const std::string& file, const Program& prog, std::string& error) {
+	return WriteFile(file, Render(prog), error) &&
+	       WriteFile(file + ".paren", Render(prog, true), error);
+}
+
+std::string DumpText(const ProgNode& prog) {
+	std::string S;
+	raw_string_ostream OS(S);
+	DumpAst(prog, DumpFormat::Text, OS);
+	DumpAst(prog, DumpFormat::JSON, OS);
+	return OS.str();
+}
+
+/// Compile - Run c on file in this process: "<value>\nast <hash>", or what
+/// went wrong.
+std::string Compile(const Config& c, const std::string& file, const std::string& dir) {
+	std::string error;
+	auto prog = ParseFile(c.Kind == Config::Parenthesized ? ParenFile(file) : file, error,
+	                      c.Kind == Config::DebugInfo);
+	if (!prog)
+		return "error: " + error;
+	if (c.Kind == Config::Roundtrip) {
+		std::string Before = DumpText(*prog), AstFile = dir + "/prog.kast";
+		if (!SaveAst(*prog, AstFile))
+			return "error: can't save the AST";
+		prog = LoadAst(AstFile, error);
+		if (!prog)
+			return "error: " + error;
+		if (DumpText(*prog) != Before)
+			return "error: the AST changed through SaveAst and LoadAst";
+	}
+
+	CompileOptions opts;
+	opts.OptLevel = c.OptLevel;
+	opts.Partitions = c.Partitions;
+	opts.DebugInfo = c.Kind == Config::DebugInfo;
+	opts.TimeProfile = c.Kind == Config::TimeProfile;
+	opts.ProfileGenerate = c.Kind == Config::ProfileGenerate;
+	ProfileCounts Profile;
+	if (c.Kind == Config::ProfileUse) {
+		if (!LoadProfile(dir + "/prog.kprof", Profile, error))
+			return "error: " + error;
+		opts.ProfileUse = &Profile;
+	}
+
+	const FunDefNode* Main = nullptr;
+	for (auto& d : prog->defs)
+		if (auto* f = dynamic_cast<const FunDefNode*>(d.get()))
+			if (f->FunDefName == "main")
+				Main = f;
+	if (!Main)
+		return "error: no main";
+
+	std::string Value;
+	{
+		auto jit = KaleidoscopeJIT::Create(false, error, c.Partitions > 1 ? c.Partitions : 0,
+		                                   opts.DebugInfo);
+		if (!jit || !jit->addProgram(*prog, file, opts, error))
+			return "error: " + error;
+		auto entry = jit->lookupEntry(*Main, error);
+		if (!entry)
+			return "error: " + error;
+		uint64_t Slot = 0;
+		entry(&Slot);
+		if (Main->Ty != ValType::F64)
+			Value = std::to_string(int64_t(Slot));
+		else if (std::isnan(BitsToDouble(Slot)))
+			Value = "nan";
+		else
+			Value = Printf("%.17g", BitsToDouble(Slot));
+	}
+	return Value + "\nast " + utohexstr(hash_value(DumpText(*prog)));
+}
+
+/// Failed - Whether result is an error, a crash or a timeout.
+bool Failed(const std::string& result) {
+	return StringRef(result).startswith("error: ") || StringRef(result).startswith("crash: ") ||
+	       result == "timeout";
+}
+
+/// Run - Compile in a child process, so crashes and hangs are reported.
+std::string Run(const Config& c, const std::string& file, const std::string& dir) {
+	outs().flush();
+	errs().flush();
+	fflush(nullptr);
+	int Fds[2];
+	if (pipe(Fds))
+		return std::string("error: pipe: ") + strerror(errno);
+	pid_t Pid = fork();
+	if (Pid < 0)
+		return std::string("error: fork: ") + strerror(errno);
+	std::string ErrFile = dir + "/stderr";
+	if (Pid == 0) {
+		close(Fds[0]);
+		alarm(Timeout);
+		// Some diagnostics go to stdout.
+		int Err = open(ErrFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (Err >= 0) {
+			dup2(Err, 1);
+			dup2(Err, 2);
+		}
+		if (c.Kind == Config::ProfileGenerate) {
+			sys::fs::remove(dir + "/prog.kprof");
+			setenv("KPROF_FILE", (dir + "/prog.kprof").c_str(), 1);
+		}
+		setenv("KPROF_REPORT", "/dev/null", 1);
+		std::string Result = Compile(c, file, dir);
+		for (size_t Done = 0; Done < Result.size();) {
+			ssize_t N = write(Fds[1], Result.data() + Done, Result.size() - Done);
+			if (N <= 0)
+				break;
+			Done += N;
+		}
+		close(Fds[1]);
+		// exit, not _exit: the profile is written at exit.
+		exit(0);
+	}
+
+	close(Fds[1]);
+	std::string Result;
+	char Buf[4096];
+	ssize_t N;
+	while ((N = read(Fds[0], Buf, sizeof(Buf))) > 0 || (N < 0 && errno == EINTR))
+		if (N > 0)
+			Result.append(Buf, N);
+	close(Fds[0]);
+	int Status;
+	while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR)
+		;
+	if (WIFSIGNALED(Status))
+		Result = WTERMSIG(Status) == SIGALRM ? "timeout"
+		                                      : std::string("crash: ") + strsignal(WTERMSIG(Status));
+	else if (!WIFEXITED(Status) || WEXITSTATUS(Status))
+		Result = "error: exit status " + std::to_string(WEXITSTATUS(Status));
+	if (Failed(Result)) {
+		// One line, with what the compiler said elsewhere.
+		std::replace(Result.begin(), Result.end(), '\n', ' ');
+		auto Buf = MemoryBuffer::getFile(ErrFile);
+		StringRef First = Buf ? (*Buf)->getBuffer().trim().split('\n').first : "";
+		if (!First.empty())
+			Result += " (" + First.str() + ")";
+	}
+	return Result;
+}
+
+/// Failure - Which configuration went wrong and how.
+struct Failure {
+	std::string Config;
+	std::string Kind;
+	bool operator==(const Failure& o) const { return Config == o.Config && Kind == o.Kind; }
+};
+
+/// FailureKind - How result differs from reference.  Numbers and generated
+/// names are masked in errors, so a reduced program can fail the same way.
+std::string FailureKind(const std::string& result, const std::string& reference) {
+	if (!Failed(result)) {
+		StringRef Value = StringRef(result).split('\n').first;
+		return Value == StringRef(reference).split('\n').first ? "AST differs" : "value differs";
+	}
+	std::string Masked;
+	for (size_t i = 0; i != result.size();) {
+		size_t End = i;
+		while (End != result.size() && isalnum(result[End]))
+			++End;
+		if (End == i) {
+			Masked += result[i++];
+			continue;
+		}
+		StringRef Word(result.data() + i, End - i);
+		StringRef Name = Word.rtrim("0123456789");
+		bool Generated = Name.size() != Word.size() &&
+		                 (Name.empty() || Name == "v" || Name == "p" || Name == "k" ||
+		                  Name == "w" || Name == "fn" || Name == "rec");
+		Masked += Generated ? StringRef("#") : Word;
+		i = End;
+	}
+	return Masked;
+}
+
+/// Check - Run the configurations on file, returning the results in results.
+/// False and f set if they disagree.
+bool Check(const std::string& file, const std::string& dir,
+           const std::vector<const Config*>& configs, std::vector<std::string>& results,
+           Failure& f) {
+	results.clear();
+	for (const Config* C : configs)
+		results.push_back(Run(*C, file, dir));
+	for (size_t i = 0; i != configs.size(); ++i) {
+		if (i == 0 ? Failed(results[0]) : results[i] != results[0]) {
+			f = {configs[i]->Name, FailureKind(results[i], results[0])};
+			return false;
+		}
+	}
+	return true;
+}
+
+void PrintResults(raw_ostream& OS, const std::vector<const Config*>& configs,
+                  const std::vector<std::string>& results) {
+	for (size_t i = 0; i != configs.size(); ++i) {
+		std::string R = results[i];
+		std::replace(R.begin(), R.end(), '\n', ' ');
+		OS << "  " << left_justify(configs[i]->Name, 24) << R << '\n';
+	}
+}
+
+
+// Reduction.
+
+/// Nodes - Every expression of prog, parents first.
+void Nodes(Expr& e, std::vector<Expr*>& out) {
+	out.push_back(&e);
+	for (auto& kid : e.Kids)
+		Nodes(kid, out);
+}
+
+std::vector<Expr*> Nodes(Program& prog) {
+	std::vector<Expr*> Out;
+	for (auto& F : prog)
+		for (auto& E : F.Body)
+			Nodes(E, Out);
+	return Out;
+}
+
+class Reducer {
+	const std::string& File;
+	const std::string& Dir;
+	std::vector<const Config*> Used;
+	Failure Target;
+	unsigned Tries = 0;
+
+	/// Fails - Whether prog still fails like the original.
+	bool Fails(const Program& prog) {
+		++Tries;
+		std::string Error;
+		if (!WriteProgram(File, prog, Error))
+			return false;
+		std::vector<std::string> Results;
+		Failure F;
+		return !Check(File, Dir, Used, Results, F) && F == Target;
+	}
+
+	/// DropCalls - Replace calls of name with a literal.
+	static void DropCalls(Expr& e, const std::string& name) {
+		for (auto& kid : e.Kids)
+			DropCalls(kid, name);
+		if (e.Kind == ExprKind::Call && e.Text == name)
+			e = Simplest(e.Ty);
+	}
+
+	bool ReduceFunctions(Program& prog) {
+		bool Changed = false;
+		for (size_t i = 0; i + 1 < prog.size();) {
+			Program Try = prog;
+			std::string Name = Try[i].Name;
+			Try.erase(Try.begin() + i);
+			for (auto& F : Try)
+				for (auto& E : F.Body)
+					DropCalls(E, Name);
+			if (Fails(Try)) {
+				prog = std::move(Try);
+				Changed = true;
+			} else {
+				++i;
+			}
+		}
+		return Changed;
+	}
+
+	bool ReduceStatements(Program& prog) {
+		bool Changed = false;
+		for (size_t f = 0; f != prog.size(); ++f)
+			for (size_t i = 0; i + 1 < prog[f].Body.size();) {
+				Program Try = prog;
+				Try[f].Body.erase(Try[f].Body.begin() + i);
+				if (Fails(Try)) {
+					prog = std::move(Try);
+					Changed = true;
+				} else {
+					++i;
+				}
+			}
+		return Changed;
+	}
+
+	/// Replacements - Simpler expressions of e's type: its operands, a
+	/// block with a statement less, then 0.  Those that don't compile fail
+	/// differently and are passed over.
+	static std::vector<Expr> Replacements(const Expr& e) {
+		std::vector<Expr> Out;
+		for (auto& kid : e.Kids)
+			if (kid.Ty == e.Ty)
+				Out.push_back(kid);
+		if (e.Kind == ExprKind::Block)
+			for (size_t i = 0; i + 1 < e.Kids.size(); ++i) {
+				Expr Fewer = e;
+				Fewer.Kids.erase(Fewer.Kids.begin() + i);
+				Out.push_back(std::move(Fewer));
+			}
+		Expr Zero = Simplest(e.Ty);
+		if (Render(e) != Render(Zero))
+			Out.push_back(std::move(Zero));
+		return Out;
+	}
+
+	bool ReduceExpressions(Program& prog) {
+		bool Changed = false;
+		for (size_t i = 0; i < Nodes(prog).size(); ++i) {
+			for (Expr& R : Replacements(*Nodes(prog)[i])) {
+				Program Try = prog;
+				*Nodes(Try)[i] = std::move(R);
+				if (Fails(Try)) {
+					prog = std::move(Try);
+					Changed = true;
+					break;
+				}
+			}
+		}
+		return Changed;
+	}
+
+public:
+	Reducer(const std::string& file, const std::string& dir, const Failure& target)
+	  : File(file), Dir(dir), Target(target) {
+		// The reference, the failing configuration and what it depends on.
+		for (const Config& C : Configs)
+			if (&C == &Configs[0] || C.Name == target.Config ||
+			    (C.Kind == Config::ProfileGenerate && target.Config == "-O2 -fprofile-use"))
+				Used.push_back(&C);
+	}
+
+	Program Reduce(Program prog) {
+		bool Changed = true;
+		while (Changed) {
+			Changed = ReduceFunctions(prog);
+			Changed |= ReduceStatements(prog);
+			Changed |= ReduceExpressions(prog);
+		}
+		return prog;
+	}
+
+	unsigned getTries() const { return Tries; }
+};
+
+} // namespace
+
+
+static void Usage() {
+	errs() << "usage: Fuzz [options]\n"
+	       << "       Fuzz -replay <file>\n"
+	       << "  -n N          programs to try (default: 100)\n"
+	       << "  -seed S       first seed; program i uses S + i (default: 1)\n"
+	       << "  -o DIR        where failing programs go (default: fuzz-out)\n"
+	       << "  -funcs N      functions besides main (default: 6)\n"
+	       << "  -stmts N      statements per function (default: 4)\n"
+	       << "  -depth N      expression depth (default: 4)\n"
+	       << "  -nest N       make main one expression nested N deep\n"
+	       << "  -stress       cycle through normal, deeply nested and huge programs\n"
+	       << "  -timeout S    seconds one configuration may take (default: 10)\n"
+	       << "  -no-reduce    keep failing programs as generated\n"
+	       << "  -v            print every program's seed and results\n"
+	       << "Every program is run at -O0 through -O3, fully parenthesized, split,\n"
+	       << "with debug info, with -pg, with a profile it generated and after a\n"
+	       << "save and load of its AST; any disagreement with -O0 is a failure.\n"
+	       << "-replay runs one file that way.\n";
+}
+
+/// ParseNumber - Set n from a decimal of at least min; false if it isn't one.
+template <typename T> static bool ParseNumber(StringRef arg, T& n, T min = 0) {
+	return !arg.getAsInteger(10, n) && n >= min;
+}
+
+int main(int argc, char** argv) {
+	unsigned Count = 100;
+	uint64_t Seed = 1;
+	std::string OutDir = "fuzz-out", Replay;
+	Shape Base;
+	bool Stress = false, Reduce = true;
+	unsigned Verbose = 0;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool HasValue = i + 1 < argc;
+		bool ok = true;
+		if (arg == "-n" && HasValue)
+			ok = ParseNumber(argv[++i], Count);
+		else if (arg == "-seed" && HasValue)
+			ok = ParseNumber(argv[++i], Seed);
+		else if (arg == "-o" && HasValue)
+			OutDir = argv[++i];
+		else if (arg == "-funcs" && HasValue)
+			ok = ParseNumber(argv[++i], Base.Funcs);
+		else if (arg == "-stmts" && HasValue)
+			ok = ParseNumber(argv[++i], Base.Stmts);
+		else if (arg == "-depth" && HasValue)
+			ok = ParseNumber(argv[++i], Base.Depth, 1u);
+		else if (arg == "-nest" && HasValue)
+			ok = ParseNumber(argv[++i], Base.Nest);
+		else if (arg == "-stress")
+			Stress = true;
+		else if (arg == "-timeout" && HasValue)
+			ok = ParseNumber(argv[++i], Timeout, 1u);
+		else if (arg == "-no-reduce")
+			Reduce = false;
+		else if (arg == "-replay" && HasValue)
+			Replay = argv[++i];
+		else if (arg == "-v")
+			++Verbose;
+		else
+			ok = false;
+		if (!ok) {
+			Usage();
+			return 1;
+		}
+	}
+
+	SmallString<128> Dir;
+	if (std::error_code EC = sys::fs::createUniqueDirectory("kfuzz", Dir)) {
+		errs() << "Fuzz: " << EC.message() << '\n';
+		return 1;
+	}
+	std::string TmpDir = Dir.str().str(), File = TmpDir + "/prog.k";
+	std::vector<const Config*> All;
+	for (const Config& C : Configs)
+		All.push_back(&C);
+	std::vector<std::string> Results;
+	Failure F;
+
+	if (!Replay.empty()) {
+		bool Ok = Check(Replay, TmpDir, All, Results, F);
+		PrintResults(outs(), All, Results);
+		if (!Ok)
+			outs() << F.Config << ": " << F.Kind << '\n';
+		sys::fs::remove_directories(TmpDir);
+		return Ok ? 0 : 1;
+	}
+
+	unsigned Failures = 0;
+	for (unsigned n = 0; n != Count; ++n) {
+		uint64_t S = Seed + n;
+		Shape Sh = Base;
+		if (Stress && n % 3 == 1)
+			Sh.Nest = std::max(Base.Nest, 500u);
+		else if (Stress && n % 3 == 2)
+			Sh.Funcs = std::max(Base.Funcs * 40, 200u);
+		Program Prog = Generator(S, Sh).Generate();
+		std::string error;
+		if (!WriteProgram(File, Prog, error)) {
+			errs() << "Fuzz: " << error << '\n';
+			return 1;
+		}
+		bool Ok = Check(File, TmpDir, All, Results, F);
+		if (Verbose || !Ok) {
+			outs() << "seed " << S << (Ok ? ": ok\n" : ": " + F.Config + ": " + F.Kind + "\n");
+			if (Verbose > 1 || !Ok)
+				PrintResults(outs(), All, Results);
+		}
+		if (Ok)
+			continue;
+
+		++Failures;
+		std::string Name = OutDir + "/seed" + std::to_string(S);
+		if (std::error_code EC = sys::fs::create_directories(OutDir)) {
+			errs() << "Fuzz: " << OutDir << ": " << EC.message() << '\n';
+			return 1;
+		}
+		std::string Report;
+		raw_string_ostream OS(Report);
+		OS << F.Config << ": " << F.Kind << '\n';
+		PrintResults(OS, All, Results);
+		if (!WriteFile(Name + ".k", Render(Prog), error) ||
+		    !WriteFile(Name + ".txt", OS.str(), error)) {
+			errs() << "Fuzz: " << error << '\n';
+			return 1;
+		}
+		if (!Reduce)
+			continue;
+		Reducer R(File, TmpDir, F);
+		Program Min = R.Reduce(std::move(Prog));
+		if (!WriteFile(Name + ".min.k", Render(Min), error)) {
+			errs() << "Fuzz: " << error << '\n';
+			return 1;
+		}
+		outs() << "  reduced in " << R.getTries() << " tries to " << Name << ".min.k\n";
+	}
+
+	sys::fs::remove_directories(TmpDir);
+	outs() << Count << " programs, " << Failures << " failing\n";
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#include "jit.h"
+#include "hostfn.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+
+
+// Host functions for programs run here.
+extern "C" int32_t putchard(int32_t c) {
+	fputc(c, stderr);
+	return 0;
+}
+
+extern "C" double printd(double x) {
+	fprintf(stderr, "%f\n", x);
+	return 0;
+}
+
+static void Usage() {
+	errs() << "usage: Jit [options] <file> [function [args...]]\n"
+	       << "  -O0..-O3      optimization level (default: -O0)\n"
+	       << "  -pg           time every call and print a profile at exit\n"
+	       << "  -f[no-]bounds-check  check array indexes (default: below -O3)\n"
+	       << "  -fprofile-generate  count branches and calls into $KPROF_FILE\n"
+	       << "  -fprofile-use=FILE  optimize with the counts in FILE\n"
+	       << "  -perf         write a perf map and jitdump for the JITed code\n"
+	       << "  -g            emit debug info and register the code with GDB\n"
+	       << "  -split N      split the program by call graph into N modules,\n"
+	       << "                optimized and compiled in parallel\n"
+	       << "  -v            print progress; repeat for parser chatter\n"
+	       << "Calls function (default: main) and prints its result.  An array\n"
+	       << "argument is written 1,2,3; its contents are printed after the call.\n"
+	       << "Programs may also call putchard(c) and printd(x), which write to\n"
+	       << "stderr, and sqrt, fabs and floor.\n";
+}
+
+int main(int argc, char** argv) {
+	CompileOptions opts;
+	bool perf = false;
+	bool debug = false;
+	std::vector<std::string> positional;
+	std::string profilefile;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && isdigit(arg[2]))
+			opts.OptLevel = std::min(arg[2] - '0', 3);
+		else if (arg == "-pg")
+			opts.TimeProfile = true;
+		else if (arg == "-fbounds-check")
+			opts.BoundsChecks = CheckMode::On;
+		else if (arg == "-fno-bounds-check")
+			opts.BoundsChecks = CheckMode::Off;
+		else if (arg == "-fprofile-generate")
+			opts.ProfileGenerate = true;
+		else if (arg.compare(0, 14, "-fprofile-use=") == 0)
+			profilefile = arg.substr(14);
+		else if (arg == "-perf")
+			perf = true;
+		else if (arg == "-g")
+			debug = opts.DebugInfo = true;
+		else if (arg == "-split" && i + 1 < argc &&
+		         !StringRef(argv[i + 1]).getAsInteger(10, opts.Partitions) && opts.Partitions > 0)
+			++i;
+		else if (arg == "-v")
+			++Verbosity;
+		else if (positional.empty() && !arg.empty() && arg[0] == '-') {
+			Usage();
+			return 1;
+		} else
+			positional.push_back(arg);
+	}
+	if (positional.empty()) {
+		Usage();
+		return 1;
+	}
+	std::string input = positional[0];
+	std::string name = positional.size() > 1 ? positional[1] : "main";
+	std::vector<std::string> args(positional.begin() + std::min<size_t>(2, positional.size()),
+	                              positional.end());
+
+	std::string error;
+	ProfileCounts profile;
+	if (!profilefile.empty()) {
+		if (!LoadProfile(profilefile, profile, error)) {
+			errs() << "Jit: " << error << '\n';
+			return 1;
+		}
+		opts.ProfileUse = &profile;
+	}
+	auto prog = ParseFile(input, error, debug);
+	if (!prog) {
+		errs() << input << ": " << error << '\n';
+		return 1;
+	}
+	const FunDefNode* def = nullptr;
+	for (auto& d : prog->defs)
+		if (auto* f = dynamic_cast<const FunDefNode*>(d.get()))
+			if (f->FunDefName == name)
+				def = f;
+	if (!def) {
+		errs() << input << ": no function '" << name << "'\n";
+		return 1;
+	}
+	if (def->FunDefArgs.size() != args.size()) {
+		errs() << input << ": '" << name << "' takes " << def->FunDefArgs.size()
+		       << " arguments\n";
+		return 1;
+	}
+	// Everything else may be inlined or dropped.
+	opts.Exports.insert(name);
+
+	if (!RegisterHostFunction("putchard", &putchard, error) ||
+	    !RegisterHostFunction("printd", &printd, error)) {
+		errs() << "Jit: " << error << '\n';
+		return 1;
+	}
+
+	auto jit = KaleidoscopeJIT::Create(perf, error, opts.Partitions > 1 ? opts.Partitions : 0,
+	                                   debug);
+	if (!jit || !jit->addProgram(*prog, input, opts, error)) {
+		errs() << input << ": " << error << '\n';
+		return 1;
+	}
+	auto entry = jit->lookupEntry(*def, error);
+	if (!entry) {
+		errs() << input << ": " << error << '\n';
+		return 1;
+	}
+
+	// Arguments and the result travel as 64-bit slots; doubles as their bits
+	// and arrays as a pointer and a length.  Elements are 8 bytes apart for
+	// every type, then packed to the element size in place.
+	std::vector<uint64_t> slots;
+	std::vector<std::vector<uint64_t>> arrays(args.size());
+	for (unsigned i = 0; i != args.size(); ++i) {
+		ValType t = def->getArgType(i);
+		ValType elt = IsArray(t) ? ElementType(t) : t;
+		SmallVector<StringRef, 8> items;
+		if (IsArray(t))
+			StringRef(args[i]).split(items, ',', -1, false);
+		else
+			items.push_back(args[i]);
+		for (StringRef item : items) {
+			double fp;
+			int64_t num;
+			bool bad = elt == ValType::F64 ? item.getAsDouble(fp) : item.getAsInteger(10, num);
+			if (bad) {
+				errs() << "Jit: bad argument '" << item << "'\n";
+				return 1;
+			}
+			arrays[i].push_back(elt == ValType::F64 ? DoubleToBits(fp) : uint64_t(num));
+		}
+		if (!IsArray(t)) {
+			slots.push_back(arrays[i][0]);
+			continue;
+		}
+		if (elt == ValType::I32) {
+			auto* packed = reinterpret_cast<int32_t*>(arrays[i].data());
+			for (size_t j = 0; j != arrays[i].size(); ++j)
+				packed[j] = int32_t(arrays[i][j]);
+		}
+		slots.push_back(uint64_t(reinterpret_cast<uintptr_t>(arrays[i].data())));
+		slots.push_back(items.size());
+	}
+	slots.resize(std::max<size_t>(slots.size(), 1));
+	entry(slots.data());
+	if (def->Ty == ValType::F64)
+		outs() << format("%.17g", BitsToDouble(slots[0])) << '\n';
+	else
+		outs() << int64_t(slots[0]) << '\n';
+
+	for (unsigned i = 0; i != args.size(); ++i) {
+		ValType t = def->getArgType(i);
+		if (!IsArray(t))
+			continue;
+		outs() << def->FunDefArgs[i] << " =";
+		for (size_t j = 0; j != arrays[i].size(); ++j) {
+			outs() << ' ';
+			if (t == ValType::ArrF64)
+				outs() << format("%.17g", BitsToDouble(arrays[i][j]));
+			else if (t == ValType::ArrI64)
+				outs() << int64_t(arrays[i][j]);
+			else
+				outs() << reinterpret_cast<int32_t*>(arrays[i].data())[j];
+		}
+		outs() << '\n';
+	}
+	return 0;
+}
@@ -1,16 +1,30 @@
 #include "parser.h"
 
 
-int main() {
+int main(int argc, char** argv) {
+	std::string filename = "../example.txt";
+	DumpFormat format = DumpFormat::Text;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-v")
+			++Verbosity;
+		else if (arg == "-json")
+			format = DumpFormat::JSON;
+		else
+			filename = arg;
+	}
         
-	Parser parser("../example.txt");
-	parser.ParseProgram();
+	Parser parser(filename);
+	if (!parser.ParseProgram()) {
+		parser.PrintDiagnostics(errs());
+		return 1;
+	}
 	auto root = parser.getRoot();
 	InitializeModule();
 
 	//std::cout << root->defs.size()<<'\n';
-	parser.PrintAst(root);
-	parser.PrintIR(root);
-	TheModule->print(errs(), nullptr);
-        return 0;
+	DumpAst(*root, format, outs());
+	bool ok = parser.PrintIR(root);
+	DumpIR(errs());
+        return ok ? 0 : 1;
 }
@@ -0,0 +1,236 @@
+#include "compile.h"
+#include "server.h"
+#include "threadpool.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <chrono>
+#include <list>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/// Metrics - Request counters and the latency of the most recent requests.
+struct Metrics {
+	std::mutex Lock;
+	uint64_t Requests = 0, Failures = 0, CacheHits = 0;
+	int QueueDepth = 0, MaxQueueDepth = 0;
+	double TotalMs = 0;
+	std::vector<double> Recent;  // ring buffer of latencies in ms
+	size_t Next = 0;
+
+	void enqueued() {
+		std::lock_guard<std::mutex> G(Lock);
+		MaxQueueDepth = std::max(MaxQueueDepth, ++QueueDepth);
+	}
+	void dequeued() {
+		std::lock_guard<std::mutex> G(Lock);
+		--QueueDepth;
+	}
+	void finished(double ms, bool ok, bool cached) {
+		std::lock_guard<std::mutex> G(Lock);
+		++Requests;
+		Failures += !ok;
+		CacheHits += cached;
+		TotalMs += ms;
+		if (Recent.size() < 1024)
+			Recent.push_back(ms);
+		else
+			Recent[Next++ % Recent.size()] = ms;
+	}
+	std::string report() {
+		std::lock_guard<std::mutex> G(Lock);
+		std::vector<double> sorted(Recent);
+		std::sort(sorted.begin(), sorted.end());
+		auto pct = [&](double p) {
+			return sorted.empty() ? 0.0 : sorted[size_t(p * (sorted.size() - 1))];
+		};
+		std::ostringstream OS;
+		OS << "stats requests=" << Requests << " failures=" << Failures
+		   << " cache_hits=" << CacheHits << " queue_depth=" << QueueDepth
+		   << " max_queue_depth=" << MaxQueueDepth
+		   << " mean_ms=" << (Requests ? TotalMs / Requests : 0.0)
+		   << " p50_ms=" << pct(0.5) << " p99_ms=" << pct(0.99);
+		return OS.str();
+	}
+};
+
+/// ResultCache - Compiled outputs by input, options and source hash, with
+/// least-recently-used eviction.
+class ResultCache {
+	std::mutex Lock;
+	size_t Capacity;
+	std::list<std::pair<std::string, std::string>> Entries;  // front is newest
+	std::map<std::string, decltype(Entries)::iterator> Index;
+public:
+	ResultCache(size_t capacity) : Capacity(capacity) {}
+
+	bool lookup(const std::string& key, std::string& data) {
+		std::lock_guard<std::mutex> G(Lock);
+		auto it = Index.find(key);
+		if (it == Index.end())
+			return false;
+		Entries.splice(Entries.begin(), Entries, it->second);
+		data = it->second->second;
+		return true;
+	}
+	void insert(const std::string& key, std::string data) {
+		std::lock_guard<std::mutex> G(Lock);
+		if (Capacity == 0 || Index.count(key))
+			return;
+		Entries.emplace_front(key, std::move(data));
+		Index[key] = Entries.begin();
+		if (Entries.size() > Capacity) {
+			Index.erase(Entries.back().first);
+			Entries.pop_back();
+		}
+	}
+};
+
+
+/// ContextJobs, ContextBytes - A worker's LLVMContext keeps every type and
+/// constant it has interned, so it is replaced after this many compiles or
+/// source bytes.
+static const unsigned ContextJobs = 256;
+static const uint64_t ContextBytes = 64 << 20;
+
+/// AstCache - Directory of cached ASTs (-ast-cache), or empty.
+static std::string AstCache;
+
+static thread_local unsigned JobsInContext = 0;
+static thread_local uint64_t BytesInContext = 0;
+
+static std::string Compile(std::istringstream& request, ResultCache& cache, bool& cached) {
+	unsigned optlevel;
+	std::string kind, input, output;
+	if (!(request >> optlevel >> kind >> input >> output) || (kind != "obj" && kind != "bc"))
+		return "error malformed compile request";
+
+	CompileOptions opts;
+	opts.OptLevel = std::min(optlevel, 3u);
+	opts.EmitBitcode = kind == "bc";
+
+	auto Src = MemoryBuffer::getFile(input);
+	if (!Src)
+		return "error cannot read " + input;
+	// Parse this same text below, so the output always matches its hash.
+	std::string source = (*Src)->getBuffer().str();
+	std::string key = input + '\0' + kind + char('0' + opts.OptLevel) + '\0' +
+	                  std::to_string(xxHash64(source));
+
+	std::string error, data;
+	if (cache.lookup(key, data)) {
+		cached = true;
+		return WriteFile(output, data, error) ? "ok cached" : "error " + error;
+	}
+
+	BytesInContext += source.size();
+	opts.ReuseContext = ++JobsInContext < ContextJobs && BytesInContext < ContextBytes;
+	if (!opts.ReuseContext)
+		JobsInContext = BytesInContext = 0;
+
+	auto prog = ParseFile(input, error, false, &source, AstCache);
+	SmallVector<char, 0> out;
+	if (!prog || !EmitProgramToBuffer(*prog, input, opts, error, out))
+		return "error " + error;
+	data.assign(out.data(), out.size());
+	if (!WriteFile(output, data, error))
+		return "error " + error;
+	cache.insert(key, std::move(data));
+	return "ok";
+}
+
+
+int main(int argc, char** argv) {
+	std::string path = DefaultSocketPath();
+	unsigned threads = std::thread::hardware_concurrency();
+	size_t cachesize = 1024;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-socket" && i + 1 < argc)
+			path = argv[++i];
+		else if (arg == "-j" && i + 1 < argc && !StringRef(argv[i + 1]).getAsInteger(10, threads) &&
+		         threads > 0)
+			++i;
+		else if (arg == "-cache" && i + 1 < argc &&
+		         !StringRef(argv[i + 1]).getAsInteger(10, cachesize))
+			++i;
+		else if (arg == "-ast-cache" && i + 1 < argc)
+			AstCache = argv[++i];
+		else if (arg == "-v")
+			++Verbosity;
+		else {
+			errs() << "usage: Server [-socket PATH] [-j N] [-cache ENTRIES] [-ast-cache DIR] [-v]\n";
+			return 1;
+		}
+	}
+
+	if (!AstCache.empty())
+		sys::fs::create_directories(AstCache);
+
+	std::string error;
+	int listenfd = ListenOn(path, error);
+	if (listenfd < 0) {
+		errs() << "error: " << error << '\n';
+		return 1;
+	}
+	// Pay for target setup once, before the first request arrives.
+	InitializeCompilerTargets();
+
+	Metrics metrics;
+	ResultCache cache(cachesize);
+	std::atomic<bool> stopping{false};
+	Log(1) << "listening on " << path << '\n';
+
+	{
+		WorkStealingPool pool(threads);
+		while (!stopping) {
+			int fd = accept(listenfd, nullptr, nullptr);
+			if (fd < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			auto start = std::chrono::steady_clock::now();
+			metrics.enqueued();
+			pool.submit([&, fd, start] {
+				metrics.dequeued();
+				std::string line, reply;
+				bool cached = false;
+				bool complete = RecvLine(fd, line);
+				std::istringstream request(line);
+				std::string command;
+				request >> command;
+
+				if (!complete)
+					reply = line.size() > MaxLineLength
+						? "error request longer than " + std::to_string(MaxLineLength) + " bytes"
+						: "error incomplete request";
+				else if (command == "compile")
+					reply = Compile(request, cache, cached);
+				else if (command == "stats")
+					reply = metrics.report();
+				else if (command == "shutdown") {
+					reply = "ok";
+					stopping = true;
+					// Wake the accept() below so the loop sees the flag.
+					shutdown(listenfd, SHUT_RDWR);
+				} else
+					reply = "error unknown request '" + command + "'";
+
+				SendLine(fd, reply);
+				close(fd);
+				if (command == "compile") {
+					std::chrono::duration<double, std::milli> ms =
+						std::chrono::steady_clock::now() - start;
+					metrics.finished(ms.count(), reply.compare(0, 2, "ok") == 0, cached);
+				}
+			});
+		}
+	}
+
+	close(listenfd);
+	unlink(path.c_str());
+	return 0;
+}
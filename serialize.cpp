@@ -0,0 +1,470 @@
+#include "serialize.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/SaveAndRestore.h"
+
+
+static const char ASTMagic[4] = {'K', 'A', 'S', 'T'};
+
+
+ASTWriter::ASTWriter(raw_ostream& os) : OS(os) {}
+
+void ASTWriter::writeHeader(uint64_t SourceHash) {
+  OS.write(ASTMagic, sizeof(ASTMagic));
+  for (unsigned i = 0; i != 4; ++i)
+    OS << char((ASTFormatVersion >> (8 * i)) & 0xff);
+  for (unsigned i = 0; i != 8; ++i)
+    OS << char((SourceHash >> (8 * i)) & 0xff);
+}
+
+void ASTWriter::writeTag(NodeTag Tag) {
+  OS << char(Tag);
+}
+
+void ASTWriter::writeUInt(uint64_t Val) {
+  encodeULEB128(Val, OS);
+}
+
+void ASTWriter::writeInt(int64_t Val) {
+  encodeSLEB128(Val, OS);
+}
+
+void ASTWriter::writeString(StringRef Str) {
+  writeUInt(Str.size());
+  OS << Str;
+}
+
+void ASTWriter::writeNode(const Node* N) {
+  if (!N) {
+    writeTag(NodeTag::Null);
+    return;
+  }
+  N->serialize(*this);
+}
+
+
+void ProgNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::Prog);
+  W.writeUInt(defs.size());
+  for (const auto& def : defs)
+    W.writeNode(def.get());
+}
+
+void StmtListNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::StmtList);
+  W.writeUInt(stmts.size());
+  for (const auto& stmt : stmts)
+    W.writeNode(stmt.get());
+}
+
+void VarNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::Var);
+  W.writeString(VarName);
+}
+
+void IndexExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::IndexExp);
+  W.writeString(ArrayName);
+  W.writeNode(Index.get());
+}
+
+void NumNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::Num);
+  W.writeUInt(uint8_t(Ty));
+  if (Ty == ValType::F64)
+    W.writeUInt(DoubleToBits(FPVal));
+  else
+    W.writeInt(NumVal);
+}
+
+void BinExpNode::serialize(ASTWriter& W) const {
+  // In the order recursion would give: the chain's operators, its innermost
+  // LHS, then the RHSs from the inside out.
+  auto Nodes = chain();
+  for (const BinExpNode* N : Nodes) {
+    W.writeTag(NodeTag::BinExp);
+    W.writeUInt(uint8_t(N->Op));
+  }
+  W.writeNode(Nodes.back()->LHS.get());
+  for (size_t i = Nodes.size(); i--;)
+    W.writeNode(Nodes[i]->RHS.get());
+}
+
+void CalleeExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::CalleeExp);
+  W.writeString(Callee);
+  W.writeUInt(CalleeArgs.size());
+  for (const auto& arg : CalleeArgs)
+    W.writeNode(arg.get());
+}
+
+void LetExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::LetExp);
+  W.writeUInt(uint8_t(VarTy));
+  W.writeNode(LetVar.get());
+  W.writeNode(LetBody.get());
+}
+
+void FunDefNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::FunDef);
+  W.writeString(FunDefName);
+  W.writeUInt(Exported);
+  W.writeUInt(FunDefArgs.size());
+  for (const auto& arg : FunDefArgs)
+    W.writeString(arg);
+  // Every parameter's type, or none if none is annotated.
+  W.writeUInt(FunDefArgTypes.size());
+  for (ValType t : FunDefArgTypes)
+    W.writeUInt(uint8_t(t));
+  W.writeUInt(uint8_t(RetTy));
+  W.writeNode(FunDefBody.get());
+}
+
+void IfExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::IfExp);
+  W.writeNode(Cond.get());
+  W.writeNode(Then.get());
+  W.writeNode(Else.get());
+}
+
+void ForExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::ForExp);
+  W.writeString(VarName);
+  W.writeNode(Start.get());
+  W.writeNode(End.get());
+  W.writeNode(Step.get());
+  W.writeNode(Body.get());
+}
+
+void WhileExpNode::serialize(ASTWriter& W) const {
+  W.writeTag(NodeTag::WhileExp);
+  W.writeNode(Cond.get());
+  W.writeNode(Body.get());
+}
+
+
+ASTReader::ASTReader(StringRef Buffer)
+  : Cur(Buffer.bytes_begin()), End(Buffer.bytes_end()) {}
+
+bool ASTReader::fail(const std::string& message) {
+  if (Error.empty())
+    Error = message;
+  return false;
+}
+
+bool ASTReader::readByte(uint8_t& Val) {
+  if (Cur == End)
+    return fail("unexpected end of AST data");
+  Val = *Cur++;
+  return true;
+}
+
+bool ASTReader::readUInt(uint64_t& Val) {
+  unsigned N = 0;
+  const char* Err = nullptr;
+  Val = decodeULEB128(Cur, &N, End, &Err);
+  if (Err)
+    return fail(Err);
+  Cur += N;
+  return true;
+}
+
+bool ASTReader::readInt(int64_t& Val) {
+  unsigned N = 0;
+  const char* Err = nullptr;
+  Val = decodeSLEB128(Cur, &N, End, &Err);
+  if (Err)
+    return fail(Err);
+  Cur += N;
+  return true;
+}
+
+bool ASTReader::readType(ValType& T) {
+  uint64_t Val;
+  if (!readUInt(Val))
+    return false;
+  if (Val > uint64_t(ValType::ArrF64))
+    return fail("unknown type " + std::to_string(Val));
+  T = ValType(Val);
+  return true;
+}
+
+bool ASTReader::readString(StringRef& Str) {
+  uint64_t Len;
+  if (!readUInt(Len))
+    return false;
+  if (Len > uint64_t(End - Cur))
+    return fail("string runs past the end of AST data");
+  Str = StringRef(reinterpret_cast<const char*>(Cur), Len);
+  Cur += Len;
+  return true;
+}
+
+bool ASTReader::readNode(std::unique_ptr<Node>& N) {
+  if (Depth == MaxTreeDepth)
+    return fail("AST nested deeper than " + std::to_string(MaxTreeDepth));
+  SaveAndRestore<unsigned> Nest(Depth, Depth + 1);
+  uint8_t Tag;
+  if (!readByte(Tag))
+    return false;
+
+  switch (NodeTag(Tag)) {
+  case NodeTag::Null:
+    N = nullptr;
+    return true;
+
+  case NodeTag::Prog:
+  case NodeTag::StmtList: {
+    // A program is the root and holds functions, which nothing else does.
+    bool Prog = NodeTag(Tag) == NodeTag::Prog;
+    if (Prog && Depth != 1)
+      return fail("program nested in another node");
+    uint64_t Count;
+    if (!readUInt(Count))
+      return false;
+    std::vector<std::unique_ptr<Node>> Children;
+    for (uint64_t i = 0; i != Count; ++i) {
+      if (Prog && !nextIs(NodeTag::FunDef))
+        return fail("program holds something other than a function");
+      Children.emplace_back();
+      if (!readChild(Children.back()))
+        return false;
+    }
+    if (Prog)
+      N = std::make_unique<ProgNode>(std::move(Children));
+    else
+      N = std::make_unique<StmtListNode>(std::move(Children));
+    return true;
+  }
+
+  case NodeTag::Var: {
+    StringRef Name;
+    if (!readString(Name))
+      return false;
+    N = std::make_unique<VarNode>(Name.str());
+    return true;
+  }
+
+  case NodeTag::IndexExp: {
+    StringRef Name;
+    std::unique_ptr<Node> Index;
+    if (!readString(Name) || !readChild(Index))
+      return false;
+    N = std::make_unique<IndexExpNode>(Name.str(), std::move(Index));
+    return true;
+  }
+
+  case NodeTag::Num: {
+    ValType Ty;
+    if (!readType(Ty))
+      return false;
+    if (Ty == ValType::F64) {
+      uint64_t Bits;
+      if (!readUInt(Bits))
+        return false;
+      N = std::make_unique<NumNode>(BitsToDouble(Bits));
+      return true;
+    }
+    int64_t Val;
+    if (!readInt(Val))
+      return false;
+    N = std::make_unique<NumNode>(Val);
+    return true;
+  }
+
+  case NodeTag::BinExp: {
+    // A BinExp LHS is read in this loop rather than recursively, however
+    // long the chain (see BinExpNode::serialize).
+    std::vector<char> Ops;
+    while (true) {
+      uint64_t Op;
+      if (!readUInt(Op))
+        return false;
+      if (Op == '=' && !nextIs(NodeTag::Var) && !nextIs(NodeTag::IndexExp))
+        return fail("assignment to something other than a variable");
+      Ops.push_back(char(Op));
+      if (!nextIs(NodeTag::BinExp))
+        break;
+      ++Cur;  // the LHS's tag
+    }
+    std::unique_ptr<Node> LHS;
+    if (!readChild(LHS))
+      return false;
+    for (size_t i = Ops.size(); i--;) {
+      std::unique_ptr<Node> RHS;
+      if (!readChild(RHS))
+        return false;
+      LHS = std::make_unique<BinExpNode>(Ops[i], std::move(LHS), std::move(RHS));
+    }
+    N = std::move(LHS);
+    return true;
+  }
+
+  case NodeTag::CalleeExp: {
+    StringRef Callee;
+    uint64_t Count;
+    if (!readString(Callee) || !readUInt(Count))
+      return false;
+    std::vector<std::unique_ptr<Node>> Args;
+    for (uint64_t i = 0; i != Count; ++i) {
+      Args.emplace_back();
+      if (!readChild(Args.back()))
+        return false;
+    }
+    N = std::make_unique<CalleeExpNode>(Callee.str(), std::move(Args));
+    return true;
+  }
+
+  case NodeTag::LetExp: {
+    ValType VarTy;
+    std::unique_ptr<Node> Var, Body;
+    if (!readType(VarTy))
+      return false;
+    if (!nextIs(NodeTag::Var))
+      return fail("let binds something other than a variable");
+    if (!readChild(Var) || !readChild(Body))
+      return false;
+    N = std::make_unique<LetExpNode>(std::move(Var), std::move(Body), VarTy);
+    return true;
+  }
+
+  case NodeTag::FunDef: {
+    if (Depth != 2)
+      return fail("function defined inside an expression");
+    StringRef Name;
+    uint64_t Exported, Count;
+    if (!readString(Name) || !readUInt(Exported) || !readUInt(Count))
+      return false;
+    std::vector<std::string> Args;
+    for (uint64_t i = 0; i != Count; ++i) {
+      StringRef Arg;
+      if (!readString(Arg))
+        return false;
+      Args.push_back(Arg.str());
+    }
+    uint64_t TypeCount;
+    if (!readUInt(TypeCount))
+      return false;
+    if (TypeCount != 0 && TypeCount != Count)
+      return fail("parameter types do not match the parameters");
+    std::vector<ValType> ArgTypes(TypeCount);
+    ValType RetTy;
+    for (auto& T : ArgTypes)
+      if (!readType(T))
+        return false;
+    std::unique_ptr<Node> Body;
+    if (!readType(RetTy) || !readChild(Body))
+      return false;
+    auto Fun = std::make_unique<FunDefNode>(Name.str(), std::move(Args), std::move(Body),
+                                            std::move(ArgTypes), RetTy);
+    Fun->Exported = Exported != 0;
+    N = std::move(Fun);
+    return true;
+  }
+
+  case NodeTag::IfExp: {
+    std::unique_ptr<Node> Cond, Then, Else;
+    if (!readChild(Cond) || !readChild(Then) || !readChild(Else))
+      return false;
+    N = std::make_unique<IfExpNode>(std::move(Cond), std::move(Then), std::move(Else));
+    return true;
+  }
+
+  case NodeTag::ForExp: {
+    StringRef Var;
+    std::unique_ptr<Node> Start, End, Step, Body;
+    if (!readString(Var) || !readChild(Start) || !readChild(End) || !readNode(Step) ||
+        !readChild(Body))
+      return false;
+    N = std::make_unique<ForExpNode>(Var.str(), std::move(Start), std::move(End),
+                                     std::move(Step), std::move(Body));
+    return true;
+  }
+
+  case NodeTag::WhileExp: {
+    std::unique_ptr<Node> Cond, Body;
+    if (!readChild(Cond) || !readChild(Body))
+      return false;
+    N = std::make_unique<WhileExpNode>(std::move(Cond), std::move(Body));
+    return true;
+  }
+  }
+  return fail("unknown node tag " + std::to_string(Tag));
+}
+
+bool ASTReader::readChild(std::unique_ptr<Node>& N) {
+  if (nextIs(NodeTag::Null))
+    return fail("missing child node");
+  return readNode(N);
+}
+
+std::unique_ptr<ProgNode> ASTReader::readProgram() {
+  if (End - Cur < 16 || memcmp(Cur, ASTMagic, sizeof(ASTMagic)) != 0) {
+    fail("not a binary AST file");
+    return nullptr;
+  }
+  uint32_t Version = 0;
+  for (unsigned i = 0; i != 4; ++i)
+    Version |= uint32_t(Cur[4 + i]) << (8 * i);
+  if (Version != ASTFormatVersion) {
+    fail("unsupported binary AST version " + std::to_string(Version));
+    return nullptr;
+  }
+  SourceHash = 0;
+  for (unsigned i = 0; i != 8; ++i)
+    SourceHash |= uint64_t(Cur[8 + i]) << (8 * i);
+  Cur += 16;
+
+  // The root must be a program; peek at its tag before decoding it.
+  if (Cur == End || NodeTag(*Cur) != NodeTag::Prog) {
+    fail("binary AST does not start with a program");
+    return nullptr;
+  }
+  std::unique_ptr<Node> Root;
+  if (!readNode(Root))
+    return nullptr;
+  return std::unique_ptr<ProgNode>(static_cast<ProgNode*>(Root.release()));
+}
+
+
+bool SaveAst(const ProgNode& prog, const std::string& filename, uint64_t SourceHash) {
+  int FD;
+  SmallString<128> TmpPath;
+  if (sys::fs::createUniqueFile(filename + ".%%%%%%.tmp", FD, TmpPath))
+    return false;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    ASTWriter W(OS);
+    W.writeHeader(SourceHash);
+    prog.serialize(W);
+    OS.close();
+    if (!OS.has_error() && !sys::fs::rename(TmpPath, filename))
+      return true;
+    OS.clear_error();
+  }
+  sys::fs::remove(TmpPath);
+  return false;
+}
+
+std::unique_ptr<ProgNode> LoadAst(const std::string& filename, std::string& error,
+                                  uint64_t SourceHash) {
+  auto BufOrErr = MemoryBuffer::getFile(filename, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    error = filename + ": " + BufOrErr.getError().message();
+    return nullptr;
+  }
+
+  ASTReader R((*BufOrErr)->getBuffer());
+  auto Root = R.readProgram();
+  if (!Root) {
+    error = filename + ": " + R.getError();
+    return nullptr;
+  }
+  if (SourceHash && R.SourceHash != SourceHash) {
+    error = filename + ": written for other source";
+    return nullptr;
+  }
+  return Root;
+}
@@ -0,0 +1,104 @@
+#ifndef Z_SERIALIZE_H
+#define Z_SERIALIZE_H
+
+#include "ast.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+/*
+ * Binary AST format.
+ *
+ *   header:  "KAST"  u32 version (little endian)  u64 source hash
+ *   body:    one node, the ProgNode, in preorder
+ *
+ * Every node starts with a one-byte NodeTag followed by its fields.  Integers
+ * are LEB128 encoded, strings are a ULEB128 length followed by the bytes, and
+ * child nodes follow their parent in declaration order.  Types (ValType)
+ * are one ULEB128 each, and f64 literals are their IEEE bits as a ULEB128.
+ * The source hash is the xxHash64 of the text the AST was parsed from, or 0
+ * if unknown.
+ */
+
+const uint32_t ASTFormatVersion = 4;
+
+enum class NodeTag : uint8_t {
+  Null = 0,
+  Prog,
+  StmtList,
+  Var,
+  Num,
+  BinExp,
+  CalleeExp,
+  LetExp,
+  FunDef,
+  IfExp,
+  ForExp,
+  WhileExp,
+  IndexExp
+};
+
+
+/// ASTWriter - Streams nodes into any raw_ostream.
+class ASTWriter {
+  raw_ostream& OS;
+public:
+  ASTWriter(raw_ostream& os);
+
+  void writeHeader(uint64_t SourceHash);
+  void writeTag(NodeTag Tag);
+  void writeUInt(uint64_t Val);
+  void writeInt(int64_t Val);
+  void writeString(StringRef Str);
+  /// writeNode - Write node, or a Null tag when it is missing.
+  void writeNode(const Node* N);
+};
+
+
+/// ASTReader - Decodes a buffer produced by ASTWriter.  The buffer is only
+/// borrowed, so a memory-mapped file is decoded where it lies; each node
+/// copies its own strings out of it.
+class ASTReader {
+  const uint8_t* Cur;
+  const uint8_t* End;
+  std::string Error;
+  unsigned Depth = 0;  // of the node being read; the root is 1
+
+  bool fail(const std::string& message);
+  /// nextIs - Whether the next node is a Tag.
+  bool nextIs(NodeTag Tag) const { return Cur != End && NodeTag(*Cur) == Tag; }
+  bool readByte(uint8_t& Val);
+  bool readUInt(uint64_t& Val);
+  bool readInt(int64_t& Val);
+  bool readType(ValType& T);
+  bool readString(StringRef& Str);
+  bool readNode(std::unique_ptr<Node>& N);
+  /// readChild - readNode, for a child that can't be missing.
+  bool readChild(std::unique_ptr<Node>& N);
+public:
+  uint64_t SourceHash = 0;
+
+  ASTReader(StringRef Buffer);
+
+  /// readProgram - Check the header and decode the program.  Returns nullptr
+  /// and sets getError() if the buffer is malformed or from another version,
+  /// or if the tree is one the parser could not have built: deeper than
+  /// MaxTreeDepth, or with a node where codegen expects another kind.
+  std::unique_ptr<ProgNode> readProgram();
+
+  const std::string& getError() const { return Error; }
+};
+
+
+/// SaveAst - Write prog to filename.  The file is written under a temporary
+/// name and renamed into place, so a reader never sees it half written.
+/// Returns false on I/O errors.
+bool SaveAst(const ProgNode& prog, const std::string& filename, uint64_t SourceHash = 0);
+
+/// LoadAst - Map filename into memory and decode it.  If SourceHash is not 0
+/// the file must have been written for that source text.  The tree has no
+/// source locations.  Returns nullptr and sets error on failure.
+std::unique_ptr<ProgNode> LoadAst(const std::string& filename, std::string& error,
+                                  uint64_t SourceHash = 0);
+
+
+#endif
@@ -0,0 +1,90 @@
+#include "server.h"
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+std::string DefaultSocketPath() {
+  return "/tmp/kaleidoscope-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool MakeAddress(const std::string& path, sockaddr_un& addr, std::string& error) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    error = "socket path too long: " + path;
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+int ListenOn(const std::string& path, std::string& error) {
+  sockaddr_un addr;
+  if (!MakeAddress(path, addr, error))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    error = strerror(errno);
+    return -1;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    error = path + ": " + strerror(errno);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ConnectTo(const std::string& path, std::string& error) {
+  sockaddr_un addr;
+  if (!MakeAddress(path, addr, error))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    error = strerror(errno);
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    error = path + ": " + strerror(errno);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool SendLine(int fd, const std::string& line) {
+  std::string buf = line + '\n';
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = send(fd, buf.data() + done, buf.size() - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+bool RecvLine(int fd, std::string& line) {
+  line.clear();
+  char buf[4096];
+  while (line.size() <= MaxLineLength) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    const char* end = static_cast<const char*>(memchr(buf, '\n', n));
+    line.append(buf, end ? end - buf : n);
+    if (end)
+      return line.size() <= MaxLineLength;
+  }
+  return false;
+}
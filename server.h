@@ -0,0 +1,42 @@
+#ifndef Z_SERVER_H
+#define Z_SERVER_H
+
+#include <string>
+
+/*
+ * Compile server protocol.  The client connects to a Unix domain socket,
+ * sends one request line and reads one reply line.
+ *
+ *   compile <optlevel> <obj|bc> <input path> <output path>
+ *       -> "ok" | "ok cached" | "error <message>"
+ *   stats     -> "stats key=value ..."
+ *   shutdown  -> "ok"
+ *
+ * Paths are absolute and must not contain spaces.
+ */
+
+/// DefaultSocketPath - Per-user socket the server listens on by default.
+std::string DefaultSocketPath();
+
+/// ListenOn - Bind and listen on path, replacing a stale socket file.
+/// Returns the socket, or -1 and sets error.
+int ListenOn(const std::string& path, std::string& error);
+
+/// ConnectTo - Connect to the server at path.  Returns -1 and sets error if
+/// nothing is listening.
+int ConnectTo(const std::string& path, std::string& error);
+
+/// SendLine - Write line and a newline to fd.
+bool SendLine(int fd, const std::string& line);
+
+/// MaxLineLength - Longest line, newline excluded, RecvLine accepts.
+const size_t MaxLineLength = 64 * 1024;
+
+/// RecvLine - Read up to the next newline (not included) from fd.  Returns
+/// false at end of input before a newline, or once the line runs past
+/// MaxLineLength; line then holds what was read.  Bytes after the newline
+/// are dropped: a connection carries one line each way.
+bool RecvLine(int fd, std::string& line);
+
+
+#endif
@@ -0,0 +1,139 @@
+#include "split.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+
+/// ForEachUser - Call fn with each instruction and global using V, looking
+/// through the constants in between.
+static void ForEachUser(const Value* V, function_ref<void(const User*)> fn) {
+  for (const User* U : V->users()) {
+    if (isa<Instruction>(U) || isa<GlobalValue>(U))
+      fn(U);
+    else if (isa<Constant>(U))
+      ForEachUser(U, fn);
+  }
+}
+
+std::vector<std::unique_ptr<Module>> SplitModuleByCalls(Module& M, unsigned count) {
+  count = std::max(count, 1u);
+
+  std::vector<Function*> Funcs;
+  DenseMap<const Function*, unsigned> Index;
+  std::vector<uint64_t> Size;
+  uint64_t Total = 0;
+  for (Function& F : M)
+    if (!F.isDeclaration()) {
+      Index[&F] = Funcs.size();
+      Funcs.push_back(&F);
+      Size.push_back(F.getInstructionCount());
+      Total += Size.back();
+    }
+
+  // Call edges, counted by call sites and heaviest first.
+  std::map<std::pair<unsigned, unsigned>, unsigned> Calls;
+  for (unsigned i = 0; i != Funcs.size(); ++i)
+    ForEachUser(Funcs[i], [&](const User* U) {
+      auto* I = dyn_cast<Instruction>(U);
+      if (!I || I->getFunction() == Funcs[i])
+        return;
+      unsigned Caller = Index.lookup(I->getFunction());
+      ++Calls[{std::min(Caller, i), std::max(Caller, i)}];
+    });
+  std::vector<std::pair<std::pair<unsigned, unsigned>, unsigned>> Edges(Calls.begin(),
+                                                                        Calls.end());
+  std::stable_sort(Edges.begin(), Edges.end(),
+                   [](const auto& a, const auto& b) { return a.second > b.second; });
+
+  // Clusters: join caller and callee while the cluster stays within an even
+  // share of the module, so a call tree is cut where it's called least.
+  uint64_t Limit = std::max<uint64_t>((Total + count - 1) / count, 1);
+  EquivalenceClasses<unsigned> Clusters;
+  std::map<unsigned, uint64_t> ClusterSize;
+  for (unsigned i = 0; i != Funcs.size(); ++i) {
+    Clusters.insert(i);
+    ClusterSize[i] = Size[i];
+  }
+  for (const auto& E : Edges) {
+    unsigned A = Clusters.getLeaderValue(E.first.first);
+    unsigned B = Clusters.getLeaderValue(E.first.second);
+    if (A == B || ClusterSize[A] + ClusterSize[B] > Limit)
+      continue;
+    uint64_t Joined = ClusterSize[A] + ClusterSize[B];
+    Clusters.unionSets(A, B);
+    ClusterSize[Clusters.getLeaderValue(A)] = Joined;
+  }
+
+  // Number the clusters by their first function, then deal them out.
+  std::map<unsigned, unsigned> ClusterOfLeader;
+  std::vector<unsigned> ClusterOf(Funcs.size());
+  std::vector<std::pair<uint64_t, unsigned>> Sizes;
+  for (unsigned i = 0; i != Funcs.size(); ++i) {
+    auto Ins = ClusterOfLeader.emplace(Clusters.getLeaderValue(i), Sizes.size());
+    if (Ins.second)
+      Sizes.push_back({0, Sizes.size()});
+    ClusterOf[i] = Ins.first->second;
+    Sizes[ClusterOf[i]].first += Size[i];
+  }
+  std::stable_sort(Sizes.begin(), Sizes.end(),
+                   [](const auto& a, const auto& b) { return a.first > b.first; });
+  std::vector<uint64_t> Load(count);
+  std::vector<unsigned> PartOfCluster(Sizes.size());
+  for (const auto& C : Sizes) {
+    unsigned P = std::min_element(Load.begin(), Load.end()) - Load.begin();
+    Load[P] += C.first;
+    PartOfCluster[C.second] = P;
+  }
+
+  DenseMap<const GlobalValue*, unsigned> PartOf;
+  for (unsigned i = 0; i != Funcs.size(); ++i)
+    PartOf[Funcs[i]] = PartOfCluster[ClusterOf[i]];
+  for (GlobalVariable& G : M.globals()) {
+    unsigned First = Funcs.size();
+    ForEachUser(&G, [&](const User* U) {
+      if (auto* I = dyn_cast<Instruction>(U))
+        First = std::min(First, Index.lookup(I->getFunction()));
+    });
+    PartOf[&G] = First == Funcs.size() ? 0 : PartOf[Funcs[First]];
+  }
+
+  // Locals used across partitions must be linked by name.
+  std::string Suffix = ".split." + utohexstr(MD5Hash(M.getModuleIdentifier()));
+  for (GlobalValue& GV : M.global_values()) {
+    if (!GV.hasLocalLinkage() || GV.isDeclaration())
+      continue;
+    unsigned P = PartOf.lookup(&GV);
+    bool Shared = false;
+    ForEachUser(&GV, [&](const User* U) {
+      if (auto* I = dyn_cast<Instruction>(U))
+        Shared |= PartOf.lookup(I->getFunction()) != P;
+      else
+        Shared |= PartOf.lookup(cast<GlobalValue>(U)) != P;
+    });
+    if (!Shared)
+      continue;
+    GV.setName((GV.hasName() ? GV.getName().str() : std::string("__unnamed")) + Suffix);
+    GV.setLinkage(GlobalValue::ExternalLinkage);
+    GV.setVisibility(GlobalValue::HiddenVisibility);
+  }
+
+  std::vector<std::unique_ptr<Module>> Parts;
+  for (unsigned p = 0; p != count; ++p) {
+    ValueToValueMapTy VMap;
+    std::unique_ptr<Module> Part = CloneModule(M, VMap, [&](const GlobalValue* GV) {
+      return PartOf.lookup(GV) == p;
+    });
+    Part->setModuleIdentifier(M.getModuleIdentifier() + "." + std::to_string(p));
+    // What the partition doesn't use is left out; that includes the other
+    // partitions' llvm.global_ctors, which can't be a declaration.
+    for (Function& F : make_early_inc_range(*Part))
+      if (F.isDeclaration() && F.use_empty())
+        F.eraseFromParent();
+    for (GlobalVariable& G : make_early_inc_range(Part->globals()))
+      if (G.isDeclaration() && G.use_empty())
+        G.eraseFromParent();
+    Parts.push_back(std::move(Part));
+  }
+  return Parts;
+}
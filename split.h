@@ -0,0 +1,26 @@
+#ifndef Z_SPLIT_H
+#define Z_SPLIT_H
+
+#include "ast.h"
+
+
+/// SplitModuleByCalls - Partition M's definitions into count modules (in
+/// M's context) that can be optimized and code-generated independently and
+/// linked back together.
+///
+/// Callers and callees are joined into clusters, the pairs with the most
+/// call sites between them first, as long as a cluster stays within an even
+/// share of the module's instructions.  Whole call trees stay together when
+/// they fit, and big ones are cut where they are called least, which is
+/// also where inlining across the cut is missed least.  Clusters are dealt
+/// out largest first to the lightest partition; some may be empty.  A
+/// global variable goes with the first function using it.
+/// Locals referenced from another partition become hidden externals, renamed
+/// with a hash of the module name so they cannot clash with another module's.
+///
+/// The result depends only on M: the same IR splits the same way every
+/// time, whatever the thread count.
+std::vector<std::unique_ptr<Module>> SplitModuleByCalls(Module& M, unsigned count);
+
+
+#endif
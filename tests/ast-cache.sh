@@ -0,0 +1,33 @@
+#!/bin/sh
+# A second compile of an unchanged file loads its AST from -ast-cache and
+# emits the same object; an edit to the file brings back a parse.
+#
+#   ast-cache.sh DRIVER SOURCE
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp "$2" "$dir/prog.k"
+
+compile() {
+	"$driver" -v -ast-cache "$dir/cache" -o "$dir/$1" "$dir/prog.k" > "$dir/log"
+}
+
+compile first
+if grep -q "AST loaded" "$dir/log"; then
+	echo "ast-cache: the first compile found a cached AST" >&2
+	exit 1
+fi
+compile second
+if ! grep -q "AST loaded" "$dir/log"; then
+	echo "ast-cache: the second compile parsed again" >&2
+	exit 1
+fi
+cmp "$dir/first/prog.o" "$dir/second/prog.o"
+
+{ echo 'def extra(x) x;'; cat "$2"; } > "$dir/prog.k"
+compile third
+if grep -q "AST loaded" "$dir/log"; then
+	echo "ast-cache: an edited file loaded the stale AST" >&2
+	exit 1
+fi
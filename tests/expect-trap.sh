@@ -0,0 +1,8 @@
+#!/bin/sh
+# Run a command and pass only if a signal (such as a trap) ends it.
+"$@"
+status=$?
+if [ $status -le 128 ]; then
+	echo "expected a trap, but the command exited with $status" >&2
+	exit 1
+fi
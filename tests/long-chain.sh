@@ -0,0 +1,25 @@
+#!/bin/sh
+# A left-folded chain of 20000 operators is not nesting: it parses, and
+# every pass walks it without running out of stack, through a save and
+# load of its AST too.
+#
+#   long-chain.sh JIT DRIVER
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk 'BEGIN {
+	s = "def sum(x) x"
+	for (i = 1; i < 10000; i++) s = s (i % 2 ? " + x" : " - 1 + x * 2 - x")
+	print s ";"
+	print "$"
+}' > "$dir/chain.k"
+
+result=$("$1" -O1 -g "$dir/chain.k" sum 3)
+if [ "$result" != 25001 ]; then
+	echo "long-chain: sum(3) was $result, not 25001" >&2
+	exit 1
+fi
+"$2" -ast-cache "$dir/cache" -o "$dir/first" "$dir/chain.k"
+"$2" -v -ast-cache "$dir/cache" -o "$dir/second" "$dir/chain.k" | grep -q "AST loaded"
+cmp "$dir/first/chain.o" "$dir/second/chain.o"
@@ -0,0 +1,23 @@
+#!/bin/sh
+# A -fprofile-generate run under Jit writes counts that a -fprofile-use
+# compile turns into branch weights and entry counts.
+#
+#   profile-use.sh JIT DRIVER LLVM-DIS SOURCE
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp "$4" "$dir/prog.k"
+
+KPROF_FILE="$dir/prog.kprof" "$1" -fprofile-generate "$dir/prog.k" > /dev/null
+"$2" -O0 -emit-llvm -fprofile-use="$dir/prog.kprof" "$dir/prog.k"
+"$3" "$dir/prog.bc" -o "$dir/prog.ll"
+
+# pick's condition held for 10 of its 100 calls.
+if ! grep -q '!{!"branch_weights", i32 10, i32 90}' "$dir/prog.ll"; then
+	echo "profile-use: pick's branch has no 10:90 weights" >&2
+	exit 1
+fi
+if ! grep -q '!{!"function_entry_count", i64 100}' "$dir/prog.ll"; then
+	echo "profile-use: pick has no entry count of 100" >&2
+	exit 1
+fi
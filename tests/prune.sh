@@ -0,0 +1,25 @@
+#!/bin/sh
+# With -export main, a function nothing exported calls is dropped and the
+# ones it does call become internal; main stays external.
+#
+#   prune.sh DRIVER LLVM-DIS SOURCE
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp "$3" "$dir/prog.k"
+
+"$1" -O0 -emit-llvm -export main "$dir/prog.k"
+"$2" "$dir/prog.bc" -o "$dir/prog.ll"
+
+if grep -q "@dead" "$dir/prog.ll"; then
+	echo "prune: dead was emitted" >&2
+	exit 1
+fi
+if ! grep -q "^define internal .*@helper(" "$dir/prog.ll"; then
+	echo "prune: helper is missing or not internal" >&2
+	exit 1
+fi
+if ! grep -q "^define i32 @main(" "$dir/prog.ll"; then
+	echo "prune: main is missing or not external" >&2
+	exit 1
+fi
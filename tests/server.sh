@@ -0,0 +1,45 @@
+#!/bin/sh
+# A Server started on a fresh socket compiles what Client sends it into the
+# object Driver would emit, answers a repeat from its cache, reports a
+# broken file as a failure and shuts down when asked.
+#
+#   server.sh SERVER CLIENT DRIVER SOURCE
+set -e
+server=$1 client=$2 driver=$3
+dir=$(mktemp -d)
+trap 'kill $pid 2>/dev/null || true; rm -rf "$dir"' EXIT
+cp "$4" "$dir/prog.k"
+printf 'def broken( 1;\n$\n' > "$dir/broken.k"
+
+"$server" -socket "$dir/sock" &
+pid=$!
+for i in $(seq 50); do
+	[ -S "$dir/sock" ] && break
+	sleep 0.1
+done
+
+send() {
+	"$client" -socket "$dir/sock" "$@"
+}
+
+send compile -O2 "$dir/prog.k" -o "$dir/first.o"
+send compile -O2 "$dir/prog.k" -o "$dir/second.o"
+"$driver" -O2 -o "$dir/driver" "$dir/prog.k"
+cmp "$dir/first.o" "$dir/driver/prog.o"
+cmp "$dir/second.o" "$dir/driver/prog.o"
+
+if send compile "$dir/broken.k" 2>/dev/null; then
+	echo "server: a broken file compiled" >&2
+	exit 1
+fi
+stats=$(send stats)
+case $stats in
+*"requests=3 failures=1 cache_hits=1 "*) ;;
+*)
+	echo "server: unexpected $stats" >&2
+	exit 1
+	;;
+esac
+
+send shutdown
+wait $pid
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Two -split compiles of the same file, with different thread counts,
+# produce the same partitions byte for byte.
+#
+#   split-determinism.sh DRIVER
+set -e
+driver=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# A call chain and some leaves, so partitioning has clusters to find.
+awk 'BEGIN {
+	print "def h0(x:i64):i64 x + 1;"
+	for (i = 1; i < 40; i++)
+		print "def h" i "(x:i64):i64 if x < " i " then h" i - 1 "(x) * 2 else x - " i ";"
+	for (i = 0; i < 20; i++)
+		print "def g" i "(x:f64):f64 x * " i ".5 + sqrt(x);"
+	print "$"
+}' > "$dir/split.k"
+
+"$driver" -O2 -j 1 -split 4 -o "$dir/first" "$dir/split.k"
+"$driver" -O2 -j 4 -split 4 -o "$dir/second" "$dir/split.k"
+for i in 0 1 2 3; do
+	cmp "$dir/first/split.$i.o" "$dir/second/split.$i.o"
+done
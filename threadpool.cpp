@@ -0,0 +1,132 @@
+#include "threadpool.h"
+
+
+/// CurrentWorker - Index of the pool worker running on this thread, or -1.
+static thread_local int CurrentWorker = -1;
+static thread_local WorkStealingPool* CurrentPool = nullptr;
+
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+  if (threads == 0)
+    threads = 1;
+  for (unsigned i = 0; i != threads; ++i)
+    Workers.push_back(std::make_unique<Worker>());
+  for (unsigned i = 0; i != threads; ++i)
+    Threads.emplace_back([this, i] { run(i); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> G(SleepLock);
+    ShuttingDown = true;
+  }
+  WorkAvailable.notify_all();
+  for (auto& T : Threads)
+    T.join();
+}
+
+void WorkStealingPool::submit(std::function<void()> job) {
+  unsigned target = CurrentPool == this ? unsigned(CurrentWorker)
+                                        : NextVictim++ % Workers.size();
+  {
+    std::lock_guard<std::mutex> G(SleepLock);
+    ++Pending;
+  }
+  {
+    std::lock_guard<std::mutex> G(Workers[target]->Lock);
+    Workers[target]->Jobs.push_back(std::move(job));
+  }
+  {
+    // Publishing under SleepLock means a worker about to sleep sees it.  A
+    // thief may already have taken the job, so Queued can briefly dip below 0.
+    std::lock_guard<std::mutex> G(SleepLock);
+    ++Queued;
+  }
+  WorkAvailable.notify_one();
+}
+
+void WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> G(SleepLock);
+  AllDone.wait(G, [this] { return Pending == 0; });
+}
+
+void WorkStealingPool::runAll(unsigned n, const std::function<void(unsigned)>& job) {
+  std::mutex Lock;
+  std::condition_variable Done;
+  unsigned Left = n;
+  std::atomic<unsigned> Started{0};
+  for (unsigned i = 0; i != n; ++i)
+    submit([&, i] {
+      ++Started;
+      job(i);
+      std::lock_guard<std::mutex> G(Lock);
+      if (--Left == 0)
+        Done.notify_all();
+    });
+
+  // From a worker these are the newest jobs of its own deque.
+  if (CurrentPool == this)
+    while (Started < n && runOne(CurrentWorker, false))
+      ;
+  std::unique_lock<std::mutex> G(Lock);
+  Done.wait(G, [&] { return Left == 0; });
+}
+
+WorkStealingPool* WorkStealingPool::current() {
+  return CurrentPool;
+}
+
+bool WorkStealingPool::popLocal(unsigned self, std::function<void()>& job) {
+  Worker& W = *Workers[self];
+  std::lock_guard<std::mutex> G(W.Lock);
+  if (W.Jobs.empty())
+    return false;
+  job = std::move(W.Jobs.back());
+  W.Jobs.pop_back();
+  --Queued;
+  return true;
+}
+
+bool WorkStealingPool::steal(unsigned self, std::function<void()>& job) {
+  for (unsigned i = 1, e = Workers.size(); i < e; ++i) {
+    Worker& Victim = *Workers[(self + i) % e];
+    std::lock_guard<std::mutex> G(Victim.Lock);
+    if (Victim.Jobs.empty())
+      continue;
+    job = std::move(Victim.Jobs.front());
+    Victim.Jobs.pop_front();
+    --Queued;
+    return true;
+  }
+  return false;
+}
+
+/// runOne - Run a job from self's deque or, with steal, another worker's.
+/// Returns false if there was none.
+bool WorkStealingPool::runOne(unsigned self, bool steal) {
+  std::function<void()> job;
+  if (!popLocal(self, job) && !(steal && this->steal(self, job)))
+    return false;
+  job();
+  std::lock_guard<std::mutex> G(SleepLock);
+  if (--Pending == 0)
+    AllDone.notify_all();
+  return true;
+}
+
+void WorkStealingPool::run(unsigned self) {
+  CurrentWorker = self;
+  CurrentPool = this;
+
+  while (true) {
+    if (runOne(self))
+      continue;
+
+    // Nothing to run anywhere; sleep until a job is published.
+    std::unique_lock<std::mutex> G(SleepLock);
+    WorkAvailable.wait(G, [this] { return ShuttingDown || Queued > 0; });
+    if (ShuttingDown && Queued == 0)
+      return;
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef Z_THREADPOOL_H
+#define Z_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// WorkStealingPool - A fixed set of workers, each with its own job deque.
+/// A worker runs its newest job first (jobs it just submitted are usually the
+/// next stage of the file it was working on) and, when it runs dry, steals
+/// the oldest job of another worker.
+class WorkStealingPool {
+  struct Worker {
+    std::mutex Lock;
+    std::deque<std::function<void()>> Jobs;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+
+  std::mutex SleepLock;
+  std::condition_variable WorkAvailable;
+  std::condition_variable AllDone;
+  std::atomic<unsigned> NextVictim{0};
+  std::atomic<int> Queued{0};  // sitting in some deque
+  unsigned Pending = 0;  // queued or running, guarded by SleepLock
+  bool ShuttingDown = false;
+
+  bool popLocal(unsigned self, std::function<void()>& job);
+  bool steal(unsigned self, std::function<void()>& job);
+  bool runOne(unsigned self, bool steal = true);
+  void run(unsigned self);
+public:
+  WorkStealingPool(unsigned threads);
+  ~WorkStealingPool();
+
+  /// submit - Queue job.  From a worker it goes to that worker's own deque,
+  /// from anywhere else to the workers in turn.
+  void submit(std::function<void()> job);
+
+  /// wait - Block until every submitted job, including jobs submitted by
+  /// other jobs, has finished.
+  void wait();
+
+  /// runAll - Run job(0) ... job(n - 1) here and return once they have
+  /// finished.  A worker of this pool may call it: it runs those of the jobs
+  /// nobody has taken yet itself instead of blocking.
+  void runAll(unsigned n, const std::function<void(unsigned)>& job);
+
+  /// current - The pool this thread is a worker of, or nullptr.
+  static WorkStealingPool* current();
+
+  unsigned size() const { return Workers.size(); }
+};
+
+
+#endif
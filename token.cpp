@@ -1,5 +1,10 @@
 #include "token.h"
 
+// The lexer keeps every token of a file; nothing beyond the start position
+// belongs in one (the parser works out span ends as it eats tokens).
+static_assert(sizeof(Token) <= sizeof(std::string) + 4 * sizeof(int),
+              "Token grew");
+
 TokenTytoStr AttrToStringDic() 
 {
   TokenTytoStr ttos = {{TokenAttr::Identifier,"ID"},
@@ -14,4 +19,5 @@ TokenTytoStr AttrToStringDic()
 }
 
 
-Token::Token(TokenAttr t, const std::string& n) : Attr(t), name(n) { }
+Token::Token(TokenAttr t, const std::string& n, int line, int col)
+  : Attr(t), name(n), Line(line), Col(col) { }
@@ -24,8 +24,9 @@ class Token {
 public:
     TokenAttr Attr;
     std::string name;
+    int Line = 0, Col = 0;  // 1-based position of the first character
 
-    Token(TokenAttr t, const std::string& n);
+    Token(TokenAttr t, const std::string& n, int line = 0, int col = 0);
 };
 
 #endif
@@ -0,0 +1,281 @@
+#include "ast.h"
+#include "hostfn.h"
+
+
+const char* TypeName(ValType t) {
+  switch (t) {
+  case ValType::I32: return "i32";
+  case ValType::I64: return "i64";
+  case ValType::F64: return "f64";
+  case ValType::ArrI32: return "[i32]";
+  case ValType::ArrI64: return "[i64]";
+  case ValType::ArrF64: return "[f64]";
+  default: return "?";
+  }
+}
+
+bool ParseTypeName(const std::string& name, ValType& t) {
+  if (name == "i32")
+    t = ValType::I32;
+  else if (name == "i64")
+    t = ValType::I64;
+  else if (name == "f64")
+    t = ValType::F64;
+  else
+    return false;
+  return true;
+}
+
+void TypeEnv::error(const std::string& message) {
+  if (!Report)
+    return;
+  ReportCodegenError("TypeError: in " + Function + ": " + message);
+  Failed = true;
+}
+
+/// CheckNarrowing - Report a value of type from going where to is expected.
+static void CheckNarrowing(TypeEnv& env, ValType from, ValType to, const std::string& what) {
+  if (IsArray(from) || IsArray(to)) {
+    if (from != to)
+      env.error(what + " is " + TypeName(from) + ", not " + TypeName(to));
+    return;
+  }
+  if (from > to)
+    env.error(what + " is " + TypeName(from) + ", not " + TypeName(to) + "; convert it with " +
+              TypeName(to) + "(...)");
+}
+
+/// CheckScalar - Report an array used as a number.
+static void CheckScalar(TypeEnv& env, ValType t, const std::string& what) {
+  if (IsArray(t))
+    env.error(what + " is an array; only its elements are values");
+}
+
+
+/// Signatures are solved for all functions together, so a call may come
+/// before the definition and recursion works: returns start Unknown and
+/// only widen, pass after pass, until nothing changes.  Anything still
+/// Unknown then (a function that only ever returns its own result) is i32.
+/// A last pass with the final signatures fills in every node's Ty and
+/// reports errors.
+ValType ProgNode::inferType(TypeEnv& env) {
+  std::vector<FunDefNode*> Funs;
+  for (auto& def : defs) {
+    auto* F = static_cast<FunDefNode*>(def.get());
+    FunctionSig& Sig = env.Functions[F->FunDefName];
+    Sig.Params.clear();
+    for (unsigned i = 0; i != F->FunDefArgs.size(); ++i)
+      Sig.Params.push_back(F->getArgType(i));
+    Sig.Ret = F->RetTy;
+    Funs.push_back(F);
+  }
+
+  env.Report = false;
+  while (true) {
+    bool Changed = false;
+    for (FunDefNode* F : Funs) {
+      ValType& Ret = env.Functions[F->FunDefName].Ret;
+      ValType T = Widen(Ret, F->inferType(env));
+      if (F->RetTy == ValType::Unknown && T != Ret) {
+        Ret = T;
+        Changed = true;
+      }
+    }
+    if (Changed)
+      continue;
+    for (auto& Sig : env.Functions)
+      if (Sig.second.Ret == ValType::Unknown) {
+        Sig.second.Ret = ValType::I32;
+        Changed = true;
+      }
+    if (!Changed)
+      break;
+  }
+
+  env.Report = true;
+  for (FunDefNode* F : Funs)
+    F->inferType(env);
+  Ty = env.Failed ? ValType::Unknown : ValType::I32;
+  return Ty;
+}
+
+ValType FunDefNode::inferType(TypeEnv& env) {
+  env.Function = FunDefName;
+  env.Vars.clear();
+  for (unsigned i = 0; i != FunDefArgs.size(); ++i)
+    env.Vars[FunDefArgs[i]] = getArgType(i);
+
+  ValType Body = FunDefBody->inferType(env);
+  CheckScalar(env, Body, "the returned value");
+  if (RetTy != ValType::Unknown) {
+    CheckNarrowing(env, Body, RetTy, "the returned value");
+    Ty = RetTy;
+  } else {
+    Ty = Widen(Body, env.Functions[FunDefName].Ret);
+  }
+  return Ty;
+}
+
+ValType StmtListNode::inferType(TypeEnv& env) {
+  Ty = ValType::I32;
+  for (auto& stmt : stmts)
+    Ty = stmt->inferType(env);
+  return Ty;
+}
+
+ValType VarNode::inferType(TypeEnv& env) {
+  // Unknown names are reported by codegen.
+  auto It = env.Vars.find(VarName);
+  Ty = It == env.Vars.end() ? ValType::I32 : It->second;
+  return Ty;
+}
+
+ValType NumNode::inferType(TypeEnv&) {
+  // Fixed by the literal.
+  return Ty;
+}
+
+ValType BinExpNode::inferType(TypeEnv& env) {
+  // Same order as codegen, so lets inside operands bind alike.
+  if (Op == '=') {
+    // The variable or element keeps its type.
+    ValType R = RHS->inferType(env);
+    ValType L = LHS->inferType(env);
+    CheckScalar(env, R, "the assigned value");
+    if (auto* Var = dynamic_cast<VarNode*>(LHS.get())) {
+      CheckScalar(env, L, Var->VarName);
+      CheckNarrowing(env, R, L, "the value assigned to " + Var->VarName);
+    } else if (auto* Elt = dynamic_cast<IndexExpNode*>(LHS.get())) {
+      CheckNarrowing(env, R, L, "the value assigned to an element of " + Elt->ArrayName);
+    }
+    Ty = L;
+    return Ty;
+  }
+  // Up the chain from its innermost LHS; see BinExpNode::chain.
+  auto Nodes = chain();
+  ValType L = Nodes.back()->LHS->inferType(env);
+  for (size_t i = Nodes.size(); i--;) {
+    BinExpNode* N = Nodes[i];
+    ValType R = N->RHS->inferType(env);
+    CheckScalar(env, L, std::string("the left operand of ") + N->Op);
+    CheckScalar(env, R, std::string("the right operand of ") + N->Op);
+    N->Ty = (N->Op == '<' || N->Op == '>') ? ValType::I32 : Widen(L, R);
+    L = N->Ty;
+  }
+  return Ty;
+}
+
+ValType CalleeExpNode::inferType(TypeEnv& env) {
+  std::vector<ValType> Args;
+  for (auto& arg : CalleeArgs)
+    Args.push_back(arg->inferType(env));
+
+  if (ParseTypeName(Callee, Ty)) {
+    if (!Args.empty())
+      CheckScalar(env, Args[0], "the converted value");
+    return Ty;
+  }
+  if (Callee == "len") {
+    if (Args.size() != 1 || !IsArray(Args[0]))
+      env.error("len takes one array");
+    Ty = ValType::I64;
+    return Ty;
+  }
+
+  // The program's own functions hide host functions.
+  const FunctionSig* Sig = nullptr;
+  auto It = env.Functions.find(Callee);
+  if (It != env.Functions.end())
+    Sig = &It->second;
+  else if (const HostFunction* Host = FindHostFunction(Callee))
+    Sig = &Host->Sig;
+  if (!Sig) {
+    // Reported by codegen.
+    Ty = ValType::I32;
+    return Ty;
+  }
+  for (unsigned i = 0; i < Args.size() && i < Sig->Params.size(); ++i)
+    CheckNarrowing(env, Args[i], Sig->Params[i],
+                   "argument " + std::to_string(i + 1) + " of " + Callee);
+  Ty = Sig->Ret;
+  return Ty;
+}
+
+ValType LetExpNode::inferType(TypeEnv& env) {
+  ValType Body = LetBody->inferType(env);
+  auto* Var = static_cast<VarNode*>(LetVar.get());
+  CheckScalar(env, Body, "the initial value of " + Var->VarName);
+  if (VarTy != ValType::Unknown) {
+    CheckNarrowing(env, Body, VarTy, "the initial value of " + Var->VarName);
+    Ty = VarTy;
+  } else {
+    Ty = Body;
+  }
+  Var->Ty = Ty;
+  env.Vars[Var->VarName] = Ty;
+  return Ty;
+}
+
+ValType IfExpNode::inferType(TypeEnv& env) {
+  CheckScalar(env, Cond->inferType(env), "the condition");
+  ValType T = Then->inferType(env);
+  ValType E = Else->inferType(env);
+  CheckScalar(env, T, "the then value");
+  CheckScalar(env, E, "the else value");
+  Ty = Widen(T, E);
+  return Ty;
+}
+
+ValType ForExpNode::getVarType() const {
+  ValType T = Widen(ValType::I32, Widen(Start->Ty, End->Ty));
+  return Step ? Widen(T, Step->Ty) : T;
+}
+
+ValType ForExpNode::inferType(TypeEnv& env) {
+  CheckScalar(env, Start->inferType(env), "the start value");
+  CheckScalar(env, End->inferType(env), "the end value");
+  if (Step) {
+    CheckScalar(env, Step->inferType(env), "the step");
+    // It would never reach End; see ForExpNode.
+    if (auto* N = dynamic_cast<NumNode*>(Step.get()))
+      if (N->Ty == ValType::F64 ? !(N->FPVal > 0) : N->NumVal <= 0)
+        env.error("the step of " + VarName + " is not positive");
+  }
+
+  // The loop variable shadows an outer one only inside the body.
+  auto Old = env.Vars.find(VarName);
+  bool HadOld = Old != env.Vars.end();
+  ValType OldTy = HadOld ? Old->second : ValType::Unknown;
+  env.Vars[VarName] = getVarType();
+  Body->inferType(env);
+  if (HadOld)
+    env.Vars[VarName] = OldTy;
+  else
+    env.Vars.erase(VarName);
+
+  Ty = ValType::I32;
+  return Ty;
+}
+
+ValType WhileExpNode::inferType(TypeEnv& env) {
+  CheckScalar(env, Cond->inferType(env), "the condition");
+  Body->inferType(env);
+  Ty = ValType::I32;
+  return Ty;
+}
+
+ValType IndexExpNode::inferType(TypeEnv& env) {
+  ValType Idx = Index->inferType(env);
+  if (Idx != ValType::I32 && Idx != ValType::I64 && Idx != ValType::Unknown)
+    env.error(std::string("an index is ") + TypeName(Idx) + ", not an integer");
+
+  auto It = env.Vars.find(ArrayName);
+  if (It == env.Vars.end() || !IsArray(It->second)) {
+    if (It != env.Vars.end())
+      env.error(ArrayName + " is not an array");
+    Ty = ValType::I32;
+    return Ty;
+  }
+  Ty = ElementType(It->second);
+  return Ty;
+}
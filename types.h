@@ -0,0 +1,87 @@
+#ifndef Z_TYPES_H
+#define Z_TYPES_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Value types.
+ *
+ * Every expression is i32, i64 or f64.  Parameters, let variables and
+ * return values may be annotated (x:i64, let y:f64 = ..., def f(x):f64);
+ * unannotated parameters are i32 and everything else is inferred (types.cpp)
+ * before code is generated:
+ *
+ *   - integer literals are i32 when they fit and i64 otherwise; literals
+ *     with a '.' or an exponent are f64,
+ *   - arithmetic on mixed operands widens to the wider type
+ *     (i32 < i64 < f64); comparisons are i32,
+ *   - an if is the wider of its arms, a block its last expression,
+ *   - a function returns the wider of everything its body can return.
+ *
+ * Widening is implicit; narrowing (into a variable, a parameter or a
+ * declared return type) is an error unless spelled out with i32(x), i64(x)
+ * or f64(x).
+ *
+ * Parameters may also be arrays of a scalar type, a:[f64].  An array is
+ * passed as two arguments, a pointer to the first element and an i64
+ * element count, so native callers hand over (data, size) of their own
+ * buffer and the function works on it in place:
+ *
+ *   def scale(a:[f64] k:f64) for i = 0 to len(a) in a[i] = a[i] * k;
+ *
+ * is  double scale(double* a, int64_t a_len, double k)  to C.  Arrays can
+ * be indexed, measured with len(a) and passed on to array parameters of the
+ * same element type; they can't be stored, returned or computed with.
+ */
+
+/// ValType - Scalars are ordered so the wider of two types is the larger.
+/// Unknown is only seen while inference is still running.
+enum class ValType : uint8_t { Unknown, I32, I64, F64, ArrI32, ArrI64, ArrF64 };
+
+inline ValType Widen(ValType a, ValType b) {
+  return a < b ? b : a;
+}
+
+inline bool IsArray(ValType t) {
+  return t >= ValType::ArrI32;
+}
+
+/// ArrayOf - The array type of scalar t.
+inline ValType ArrayOf(ValType t) {
+  return ValType(uint8_t(t) - uint8_t(ValType::I32) + uint8_t(ValType::ArrI32));
+}
+
+/// ElementType - The scalar type of array t.
+inline ValType ElementType(ValType t) {
+  return ValType(uint8_t(t) - uint8_t(ValType::ArrI32) + uint8_t(ValType::I32));
+}
+
+/// TypeName - "i32", "[f64]" etc., or "?".
+const char* TypeName(ValType t);
+
+/// ParseTypeName - Set t from "i32", "i64" or "f64"; false for other names.
+/// Array types are spelled with brackets, which the parser handles.
+bool ParseTypeName(const std::string& name, ValType& t);
+
+
+struct FunctionSig {
+  std::vector<ValType> Params;
+  ValType Ret = ValType::Unknown;
+};
+
+/// TypeEnv - What inference knows while walking one function.
+struct TypeEnv {
+  std::map<std::string, FunctionSig> Functions;
+  std::map<std::string, ValType> Vars;
+  std::string Function;
+  /// Report - Print type errors.  Off until the signatures have settled.
+  bool Report = false;
+  bool Failed = false;
+
+  void error(const std::string& message);
+};
+
+#endif